@@ -0,0 +1,164 @@
+#ifndef ALPHABET_H
+#define ALPHABET_H
+
+/**
+* Alphabets for the text and key
+* 1. Each alphabet is listed once in alphabets.def as runs of characters.
+* 2. This header expands every entry into its own functions at compile time, with the
+*    size and runs as constants, so each kernel is as cheap as a hand written one.
+* 3. The kernels are a branch-free loop the compiler vectorizes, with a scalar loop
+*    for the bytes left over.
+*
+* The handshake carries the alphabet id in its last byte, 0 is the default alphabet,
+* so "enc\0" still means uppercase and a space.
+*/
+
+#include <string.h>
+
+// Value of a character that is not in the alphabet
+#define ALPHABET_INVALID 0xff
+
+// Alphabet ids
+enum {
+#define ALPHABET(name, runs) ALPHABET_##name,
+#include "alphabets.def"
+#undef ALPHABET
+    ALPHABET_COUNT
+};
+
+// Number of characters in each alphabet
+#define RUN(first, last) + ((last) - (first) + 1)
+enum {
+#define ALPHABET(name, runs) ALPHABET_SIZE_##name = 0 runs,
+#include "alphabets.def"
+#undef ALPHABET
+};
+#undef RUN
+
+// Text plus the key must fit in an unsigned char
+#define ALPHABET(name, runs) \
+    _Static_assert(ALPHABET_SIZE_##name <= 127, "alphabet " #name " has more than 127 characters");
+#include "alphabets.def"
+#undef ALPHABET
+
+// Runs never overlap, so each run ORs in its part of the value under a mask that is
+// 0xff for characters in the run and 0 otherwise. Masks instead of ?: keep the
+// loops free of branches however many runs an alphabet has
+
+// Converts a character into its number, a run adds its offset to the characters in it
+// Returns ALPHABET_INVALID for characters not in the alphabet
+#define RUN(first, last) \
+    inRun = -((unsigned char)(c - (first)) <= (last) - (first)); \
+    value |= inRun & (unsigned char)(c - (first) + base); \
+    missing &= ~inRun; \
+    base += (last) - (first) + 1;
+#define ALPHABET(name, runs) \
+static inline unsigned char alphabetValue_##name(unsigned char c) { \
+    unsigned char value = 0, missing = ALPHABET_INVALID, inRun, base = 0; \
+    runs \
+    return value | missing; \
+}
+#include "alphabets.def"
+#undef ALPHABET
+#undef RUN
+
+// Converts a number back into its character
+#define RUN(first, last) \
+    symbol |= -((unsigned char)(value - base) <= (last) - (first)) & (unsigned char)(value - base + (first)); \
+    base += (last) - (first) + 1;
+#define ALPHABET(name, runs) \
+static inline unsigned char alphabetSymbol_##name(unsigned char value) { \
+    unsigned char symbol = 0, base = 0; \
+    runs \
+    return symbol; \
+}
+#include "alphabets.def"
+#undef ALPHABET
+#undef RUN
+
+// https://en.wikipedia.org/wiki/One-time_pad
+// Transforms len characters of text with the key into result
+// Encrypting adds the key, decrypting subtracts it, which is the same as adding the size minus the key
+// Validation is done in the same pass so each byte is only read once, and the loop
+// has no early exit so the compiler can vectorize it
+// Returns nonzero if any character of the text or key is not in the alphabet
+#define RUN(first, last) \
+    inText = -((unsigned char)(textChar - (first)) <= (last) - (first)); \
+    inKey = -((unsigned char)(keyChar - (first)) <= (last) - (first)); \
+    textValue |= inText & (unsigned char)(textChar - (first) + base); \
+    keyValue |= inKey & (unsigned char)(keyChar - (first) + base); \
+    textMissing &= ~inText; \
+    keyMissing &= ~inKey; \
+    base += (last) - (first) + 1;
+#define ALPHABET(name, runs) \
+static inline unsigned char otpKernel_##name(const char* text, const char* key, char* result, \
+                                             long len, int decrypt) { \
+    const unsigned char size = ALPHABET_SIZE_##name; \
+    unsigned char invalid = 0; \
+    for (long i = 0; i < len; i++) { \
+        unsigned char textChar = text[i], keyChar = key[i]; \
+        unsigned char textValue = 0, keyValue = 0, inText, inKey, base = 0; \
+        unsigned char textMissing = ALPHABET_INVALID, keyMissing = ALPHABET_INVALID; \
+        runs \
+        invalid |= textMissing | keyMissing; \
+        keyValue = decrypt ? size - keyValue : keyValue; \
+        /* Wrap around if the result is past the last character */ \
+        unsigned char resultValue = textValue + keyValue; \
+        resultValue = (resultValue >= size) ? resultValue - size : resultValue; \
+        result[i] = alphabetSymbol_##name(resultValue); \
+    } \
+    return invalid; \
+}
+#include "alphabets.def"
+#undef ALPHABET
+#undef RUN
+
+// Finds an alphabet by its name in alphabets.def, returns -1 if there is none
+static inline int alphabetLookup(const char* name) {
+#define ALPHABET(alphabetName, runs) if (strcmp(name, #alphabetName) == 0) return ALPHABET_##alphabetName;
+#include "alphabets.def"
+#undef ALPHABET
+    return -1;
+}
+
+// The functions below pick an alphabet's function by id
+// The choice is made once per call, never per character inside a kernel
+
+static inline int alphabetSize(int alphabet) {
+    switch (alphabet) {
+#define ALPHABET(name, runs) case ALPHABET_##name: return ALPHABET_SIZE_##name;
+#include "alphabets.def"
+#undef ALPHABET
+    }
+    return 0;
+}
+
+static inline unsigned char alphabetValue(int alphabet, unsigned char c) {
+    switch (alphabet) {
+#define ALPHABET(name, runs) case ALPHABET_##name: return alphabetValue_##name(c);
+#include "alphabets.def"
+#undef ALPHABET
+    }
+    return ALPHABET_INVALID;
+}
+
+static inline unsigned char alphabetSymbol(int alphabet, unsigned char value) {
+    switch (alphabet) {
+#define ALPHABET(name, runs) case ALPHABET_##name: return alphabetSymbol_##name(value);
+#include "alphabets.def"
+#undef ALPHABET
+    }
+    return 0;
+}
+
+static inline unsigned char alphabetKernel(int alphabet, const char* text, const char* key,
+                                           char* result, long len, int decrypt) {
+    switch (alphabet) {
+#define ALPHABET(name, runs) case ALPHABET_##name: return otpKernel_##name(text, key, result, len, decrypt);
+#include "alphabets.def"
+#undef ALPHABET
+    }
+    return 1;
+}
+
+#endif
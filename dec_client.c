@@ -6,6 +6,14 @@
 #include <sys/types.h>  // ssize_t
 #include <sys/socket.h> // send(),recv()
 #include <netdb.h>      // gethostbyname()
+#include <getopt.h>     // getopt_long()
+#include <fcntl.h>      // open()
+#include <sys/wait.h>   // waitpid()
+#include <sys/stat.h>   // fstat()
+#include <sys/mman.h>   // mmap()
+#include <limits.h>     // INT_MAX
+#include "trace.h"      // TRACE_BEGIN(), TRACE_END()
+#include "alphabet.h"   // alphabetValue()
 
 /**
 * Client code
@@ -15,6 +23,12 @@
 */
 
 #define BUFFER_CAPACITY 1000
+// Stream segments start on a multiple of this so each pwrite() is page aligned
+#define SEGMENT_ALIGNMENT 4096
+// Most connections --streams will open at once
+#define MAX_STREAMS 64
+// Sent in place of a message length to start a batch request, same as otp_server.c
+#define BATCH_REQUEST -1000
 
 // Print formatted error message and exit with status code +
 void error(int exitCode, const char *message) {
@@ -43,10 +57,83 @@ void setupAddressStruct(struct sockaddr_in* address,
         hostInfo->h_length);
 }
 
+// Reads a whole file as is, for --binary where every byte value is allowed
+// The number of bytes read is stored in length
+char* receiveRawFilePath(const char* filepath, int* length) {
+    // Open file in read mode
+    FILE* f = fopen(filepath, "r");
+    if (!f)
+        error(1, "Cannot open file");
+    // Find the size of the file so it can be read in one call
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+    if (size < 0) {
+        fclose(f);
+        error(1, "Cannot read file");
+    }
+    // One request carries at most INT_MAX bytes, bigger files go over --streams
+    if (size > INT_MAX) {
+        fclose(f);
+        error(1, "File is too large for one request, use --streams");
+    }
+    char* data = malloc(size + 1);
+    if (!data) {
+        fclose(f);
+        error(1, "Memory allocation failed");
+    }
+    size_t len = fread(data, 1, size, f);
+    fclose(f);
+    data[len] = '\0';
+    *length = len;
+    return data;
+}
+
+// Reads a file without checking each character, only the trailing newline is removed
+// Used for trusted input since the server validates in the same pass as the transform
+char* receiveTrustedFilePath(const char* filepath) {
+    int length;
+    char* data = receiveRawFilePath(filepath, &length);
+    // Strip the newline at the end of the file
+    if (length > 0 && data[length - 1] == '\n')
+        length--;
+    data[length] = '\0';
+    return data;
+}
+
+// Maps a whole file read only, for --streams where each child sends its segment straight
+// from the mapping, so the file is never copied and can be bigger than one request
+// The length without the trailing newline is stored in length, binary keeps the newline
+const char* mapFilePath(const char* filepath, off_t* length, int binary) {
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+        error(1, "Cannot open file");
+    struct stat info;
+    if (fstat(fd, &info) < 0)
+        error(1, "Cannot read file");
+    off_t size = info.st_size;
+    // mmap() can't map an empty file
+    if (size == 0) {
+        close(fd);
+        *length = 0;
+        return "";
+    }
+    const char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        error(1, "Cannot map file");
+    // The mapping stays valid after the file is closed
+    close(fd);
+    if (!binary && data[size - 1] == '\n')
+        size--;
+    *length = size;
+    return data;
+}
+
 // Adapted from example code from Client Program section 
 // https://canvas.oregonstate.edu/courses/1999732/pages/exploration-client-server-communication-via-sockets?module_item_id=25329397
 // Functions reads a file path and returns the contents of the file as a string
-char* receiveFilePath(const char* filepath) {
+// Every character has to be in the alphabet, newlines are left out
+char* receiveFilePath(const char* filepath, int alphabet) {
     // Open file in read mode
     FILE* f = fopen(filepath, "r");
     if (!f) 
@@ -63,12 +150,11 @@ char* receiveFilePath(const char* filepath) {
     int ch;
     // Read one character at a time from file until end of file
     while ((ch = fgetc(f)) != EOF) {
-        // Check if the character is uppercase, space, or newline
-        int isUppercase = (ch >= 'A' && ch <= 'Z');
-        int isSpace = (ch == ' ');
+        // Checks if the character is in the alphabet or a newline
+        int inAlphabet = (alphabetValue(alphabet, ch) != ALPHABET_INVALID);
         int isNewline = (ch == '\n');
         // If teh character is not valid, free memory and exit with error
-        if (!isUppercase && !isSpace && !isNewline) {
+        if (!inAlphabet && !isNewline) {
             free(data);
             fclose(f);
             error(1, "Invalid character in file");
@@ -76,6 +162,12 @@ char* receiveFilePath(const char* filepath) {
         // Skip newlines
         if (isNewline) 
             continue;
+        // One request carries at most INT_MAX bytes, bigger files go over --streams
+        if (length == INT_MAX) {
+            free(data);
+            fclose(f);
+            error(1, "File is too large for one request, use --streams");
+        }
         // Checks if there is enough space to store more characters
         if (length + 1 >= capacity) {
             // Double capacity for more characters
@@ -103,9 +195,9 @@ char* receiveFilePath(const char* filepath) {
 
 // Code adapted from the code in Server Program section
 // https://canvas.oregonstate.edu/courses/1999732/pages/exploration-client-server-communication-via-sockets?module_item_id=25329397
-void sendData(int connectionSocket, char* data) {
-    // Calculate the number of characters 
-    int len = strlen(data);
+// Sends len bytes of data, which doesn't need to be null terminated
+void sendDataLength(int connectionSocket, const char* data, int len) {
+    TRACE_BEGIN(start);
     // Sends the length of the data  
     int charsWritten = send(connectionSocket, &len, sizeof(len), 0);
     // If negative, error occurred 
@@ -131,11 +223,15 @@ void sendData(int connectionSocket, char* data) {
         // Updates how many bytes were successfully sent
         totalSent += charsWritten;
     }
+    TRACE_END("sendData", start);
 }
 
+
 // Code adapted from the code Server Program section 
 // https://canvas.oregonstate.edu/courses/1999732/pages/exploration-client-server-communication-via-sockets?module_item_id=25329397
-char* receiveData(int connectionSocket) {
+// The number of bytes received is stored in length, binary data can contain null bytes
+char* receiveData(int connectionSocket, int* length) {
+    TRACE_BEGIN(start);
     int len;
     int charsRead;
     // Receive the length of the incoming message
@@ -146,6 +242,16 @@ char* receiveData(int connectionSocket) {
         error(1, "CLIENT: ERROR reading from socket");
     }
 
+    // A negative length is an error reply from the server
+    // The error code is followed by a message explaining it
+    if (len < 0) {
+        int messageLen;
+        char* message = receiveData(connectionSocket, &messageLen);
+        fprintf(stderr, "Client error: server rejected request (%d): %s\n", -len, message);
+        free(message);
+        exit(1);
+    }
+
     char* result = malloc(len + 1);  // Allocate buffer for incoming message
     if (!result) {
         error(1, "CLIENT: Memory allocation failed");
@@ -169,6 +275,8 @@ char* receiveData(int connectionSocket) {
         totalRead += charsRead;
     }
     result[len] = '\0'; 
+    *length = len;
+    TRACE_END("receiveData", start);
     return result;
 }
 
@@ -176,52 +284,368 @@ char* receiveData(int connectionSocket) {
 // https://github.com/CS-344-nilsstreedain/program4/blob/main/dec_client.c
 // Verify server
 // Takes a socket descriptor that represents the network connection
-void verifyServer(int connectionSocket) {
-    // Handshake identifier
-    char id[] = "dec";
+// id is "dec", or "xor" for --binary, with the alphabet in the last byte
+void verifyServer(int connectionSocket, const char* id) {
     char response[4] = {0};
     // Sends handshake message to the server via the socket
-    if (send(connectionSocket, id, sizeof(id), 0) < 0)
+    // The identifier is 3 characters and the null terminator
+    if (send(connectionSocket, id, 4, 0) < 0)
         error(1, "Failed to send handshake");
+    // Receives handshake response from server
     if (recv(connectionSocket, response, sizeof(response), 0) < 0)
         error(1, "Failed to receive handshake");
-    // Compares the "dec" string with the received response
-    if (strcmp(id, response) != 0) {
+    // Compares the identifier with the received response
+    if (strncmp(id, response, sizeof(response)) != 0) {
         close(connectionSocket);
         error(2, "Connected to incompatible server");
     }
 }
 
-int main(int argc, const char* argv[]) {
-    int socketFD, charsWritten, charsRead;
-    // Checks if the user provided program name, plaintext file, key file, and port number
-    if (argc != 4)
-        error(1, "Usage: ./enc_client <plaintext> <key> <portNumber>");
-    // Calls receiveFilePath() to read the plaintext file
-    char* plaintext = receiveFilePath(argv[1]);
-    // Calls receiveFilePath() to read the key file
-    char* key = receiveFilePath(argv[2]);
-    if (strlen(key) < strlen(plaintext))
-        error(1, "Key is shorter than plaintext");
+// Connects to the server on localhost at port and does the handshake with id
+// Returns the connected socket
+int connectServer(int port, const char* id) {
     // Create the socket that will listen for connections
-    socketFD = socket(AF_INET, SOCK_STREAM, 0); 
+    int socketFD = socket(AF_INET, SOCK_STREAM, 0); 
     if (socketFD < 0){
         error(1, "CLIENT: ERROR opening socket");
     }
     struct sockaddr_in serverAddress;
     // Set up the server address struct 
-    setupAddressStruct(&serverAddress, atoi(argv[3]), "localhost");
+    setupAddressStruct(&serverAddress, port, "localhost");
     // Connect to the server
+    TRACE_BEGIN(connectStart);
     if (connect(socketFD, 
         (struct sockaddr*)&serverAddress, 
         sizeof(serverAddress)) < 0)
         error(1, "CLIENT: ERROR connecting");
-    verifyServer(socketFD);
-    sendData(socketFD, plaintext);
-    sendData(socketFD, key);
+    TRACE_END("connect", connectStart);
+    TRACE_BEGIN(verifyStart);
+    verifyServer(socketFD, id);
+    TRACE_END("verifyServer", verifyStart);
+    return socketFD;
+}
+
+// Splits the ciphertext and key into streams segments and sends each one over its own connection
+// ports is a comma separated list, segment i goes to ports[i % number of ports]
+// Each child writes its plaintext at the segment's offset in outputFD with pwrite()
+// so the segments can finish in any order
+// id is the handshake, binary leaves off the newline at the end
+// Totals and offsets are off_t so the text can be bigger than one request, only each
+// segment has to fit in the int length of a message
+// Unless trusted, each child checks its own segment is in the alphabet, a newline in
+// the middle of the text counts as an invalid character since segments are sent as is
+void transformStreams(const char* text, off_t len, const char* key, off_t keyLen, int streams,
+                      const char* ports, int outputFD, const char* id, int binary, int trusted) {
+    // Results are written after anything already in the output file
+    off_t base = lseek(outputFD, 0, SEEK_CUR);
+    if (base < 0 || (fcntl(outputFD, F_GETFL) & O_APPEND))
+        error(1, "--streams needs --output or stdout redirected to a file");
+    // Reads the port list
+    int portList[MAX_STREAMS];
+    int portCount = 0;
+    const char* p = ports;
+    while (*p && portCount < MAX_STREAMS) {
+        portList[portCount++] = atoi(p);
+        p = strchr(p, ',');
+        if (!p)
+            break;
+        p++;
+    }
+    // Segment size is rounded up to SEGMENT_ALIGNMENT
+    off_t segmentSize = (len + streams - 1) / streams;
+    segmentSize = (segmentSize + SEGMENT_ALIGNMENT - 1) / SEGMENT_ALIGNMENT * SEGMENT_ALIGNMENT;
+    if (segmentSize > INT_MAX)
+        error(1, "Each stream can send at most 2 GiB, use more --streams");
+    int children = 0;
+    for (int i = 0; i < streams && i * segmentSize < len; i++) {
+        off_t offset = i * segmentSize;
+        int segmentLen = (len - offset < segmentSize) ? len - offset : segmentSize;
+        // A short key is sent as is, the server replies with an error
+        off_t keyLeft = (keyLen > offset) ? keyLen - offset : 0;
+        int keySegmentLen = (keyLeft < segmentLen) ? keyLeft : segmentLen;
+        pid_t spawnpid = fork();
+        switch (spawnpid) {
+            case -1:
+                error(1, "CLIENT: ERROR fork failed");
+                break;
+            case 0: {
+                // Child process checks and sends one segment
+                if (!binary && !trusted) {
+                    for (int j = 0; j < segmentLen; j++) {
+                        if (alphabetValue(id[3], text[offset + j]) == ALPHABET_INVALID)
+                            error(1, "Invalid character in file");
+                    }
+                    for (int j = 0; j < keySegmentLen; j++) {
+                        if (alphabetValue(id[3], key[offset + j]) == ALPHABET_INVALID)
+                            error(1, "Invalid character in file");
+                    }
+                }
+                int socketFD = connectServer(portList[i % portCount], id);
+                sendDataLength(socketFD, text + offset, segmentLen);
+                sendDataLength(socketFD, key + offset, keySegmentLen);
+                int resultLen;
+                char* result = receiveData(socketFD, &resultLen);
+                // A short reply would make pwrite() read past the end of result
+                if (resultLen != segmentLen)
+                    error(1, "CLIENT: ERROR reply doesn't match segment");
+                int totalWritten = 0;
+                while (totalWritten < segmentLen) {
+                    ssize_t written = pwrite(outputFD, result + totalWritten, segmentLen - totalWritten,
+                                             base + offset + totalWritten);
+                    if (written < 0)
+                        error(1, "CLIENT: ERROR writing output");
+                    totalWritten += written;
+                }
+                free(result);
+                close(socketFD);
+                exit(0);
+            }
+            default:
+                children++;
+        }
+    }
+    // Waits for every segment, the first failure is the exit status
+    int exitCode = 0;
+    int status;
+    while (children > 0) {
+        if (wait(&status) < 0)
+            error(1, "CLIENT: ERROR waiting for streams");
+        children--;
+        if (exitCode == 0 && !(WIFEXITED(status) && WEXITSTATUS(status) == 0))
+            exitCode = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    }
+    if (exitCode != 0)
+        exit(exitCode);
+    // Ends the output with a newline like printf() does for a single stream
+    if (!binary && pwrite(outputFD, "\n", 1, base + len) != 1)
+        error(1, "CLIENT: ERROR writing output");
+}
+
+// Sends every line of the ciphertext file as its own record in one batch request
+// Line i of the key file is the key for line i of the ciphertext file
+// The records go out back to back with an offsets table, see otpBatchTransform
+// in otp_server.c, and one result line is printed per record
+void transformBatch(const char* textPath, const char* keyPath, int port, int trusted, int alphabet) {
+    int len, keyLen;
+    char* text = receiveRawFilePath(textPath, &len);
+    char* keys = receiveRawFilePath(keyPath, &keyLen);
+    // A newline at the end of the file doesn't start another record
+    if (len > 0 && text[len - 1] == '\n')
+        len--;
+    // Records are counted first so the offsets table is allocated once
+    int count = 1;
+    for (int i = 0; i < len; i++) {
+        if (text[i] == '\n')
+            count++;
+    }
+    int* offsets = malloc((count + 1) * sizeof(int));
+    char* records = malloc(len + 1);
+    char* recordKeys = malloc(len + 1);
+    if (!offsets || !records || !recordKeys)
+        error(1, "Memory allocation failed");
+    int record = 0;
+    int total = 0;
+    int keyStart = 0;
+    offsets[0] = 0;
+    for (int i = 0; i <= len; i++) {
+        if (i < len && text[i] != '\n') {
+            records[total++] = text[i];
+            continue;
+        }
+        // End of a record, its key is the next line of the key file cut to the same length
+        int recordLen = total - offsets[record];
+        int keyEnd = keyStart;
+        while (keyEnd < keyLen && keys[keyEnd] != '\n')
+            keyEnd++;
+        if (keyEnd - keyStart < recordLen)
+            error(1, "Key is shorter than ciphertext");
+        memcpy(recordKeys + offsets[record], keys + keyStart, recordLen);
+        keyStart = keyEnd + 1;
+        offsets[++record] = total;
+    }
+    if (!trusted) {
+        // Checks every character is in the alphabet
+        for (int i = 0; i < total; i++) {
+            int textValid = (alphabetValue(alphabet, records[i]) != ALPHABET_INVALID);
+            int keyValid = (alphabetValue(alphabet, recordKeys[i]) != ALPHABET_INVALID);
+            if (!textValid || !keyValid)
+                error(1, "Invalid character in file");
+        }
+    }
+    char id[4] = "dec";
+    id[3] = alphabet;
+    int socketFD = connectServer(port, id);
+    int header = BATCH_REQUEST;
+    if (send(socketFD, &header, sizeof(header), 0) < 0)
+        error(1, "CLIENT: ERROR writing to socket");
+    sendDataLength(socketFD, (char*)offsets, (count + 1) * sizeof(int));
+    sendDataLength(socketFD, records, total);
+    sendDataLength(socketFD, recordKeys, total);
+    // The reply starts with BATCH_REQUEST, anything else is an error code
+    if (recv(socketFD, &header, sizeof(header), MSG_WAITALL) != sizeof(header))
+        error(1, "CLIENT: ERROR reading from socket");
+    if (header != BATCH_REQUEST) {
+        int messageLen;
+        char* message = receiveData(socketFD, &messageLen);
+        fprintf(stderr, "Client error: server rejected request (%d): %s\n", -header, message);
+        exit(1);
+    }
+    int tableLen, resultLen;
+    int* resultOffsets = (int*) receiveData(socketFD, &tableLen);
+    char* result = receiveData(socketFD, &resultLen);
+    if (tableLen != (count + 1) * (int)sizeof(int) || resultLen != total)
+        error(1, "CLIENT: ERROR batch reply doesn't match request");
+    // Same checks the server makes, the table has to cover the result exactly
+    int valid = (resultOffsets[0] == 0) && (resultOffsets[count] == total);
+    for (int i = 0; valid && i < count; i++) {
+        valid = (resultOffsets[i] <= resultOffsets[i + 1]);
+    }
+    if (!valid)
+        error(1, "CLIENT: ERROR batch reply has invalid offsets");
+    // Prints one line per record
+    for (int i = 0; i < count; i++) {
+        fwrite(result + resultOffsets[i], 1, resultOffsets[i + 1] - resultOffsets[i], stdout);
+        putchar('\n');
+    }
+    free(resultOffsets);
+    free(result);
+    free(offsets);
+    free(records);
+    free(recordKeys);
+    free(text);
+    free(keys);
+    close(socketFD);
+}
+
+int main(int argc, const char* argv[]) {
+    int socketFD;
+    // --trusted skips reading the files one character at a time to validate them
+    int trusted = 0;
+    // --binary XORs the raw bytes of the files with the key, any byte value is allowed
+    int binary = 0;
+    // --batch sends each line of the file as its own record in one request
+    int batch = 0;
+    // --streams splits the text over that many connections, --output is where they write
+    int streams = 1;
+    const char* outputPath = NULL;
+    // --alphabet picks one of the alphabets in alphabets.def for the text and key
+    int alphabet = 0;
+    static struct option options[] = {
+        {"trusted", no_argument, 0, 't'},
+        {"binary", no_argument, 0, 'b'},
+        {"batch", no_argument, 0, 'm'},
+        {"streams", required_argument, 0, 's'},
+        {"output", required_argument, 0, 'o'},
+        {"alphabet", required_argument, 0, 'a'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, (char* const*)argv, "tbms:o:a:", options, NULL)) != -1) {
+        switch (opt) {
+            case 't':
+                trusted = 1;
+                break;
+            case 'b':
+                binary = 1;
+                break;
+            case 'm':
+                batch = 1;
+                break;
+            case 's':
+                streams = atoi(optarg);
+                if (streams < 1 || streams > MAX_STREAMS)
+                    error(1, "--streams must be between 1 and 64");
+                break;
+            case 'o':
+                outputPath = optarg;
+                break;
+            case 'a':
+                alphabet = alphabetLookup(optarg);
+                if (alphabet < 0)
+                    error(1, "Unknown alphabet, see alphabets.def");
+                break;
+            default:
+                error(1, "Usage: ./dec_client [--trusted] [--binary | --batch] [--streams N] [--output file] [--alphabet name] <ciphertext> <key> <portNumber[,portNumber...]>");
+        }
+    }
+    // Checks if the user provided ciphertext file, key file, and port number
+    if (argc - optind != 3)
+        error(1, "Usage: ./dec_client [--trusted] [--binary | --batch] [--streams N] [--output file] [--alphabet name] <ciphertext> <key> <portNumber[,portNumber...]>");
+    const char* ciphertextPath = argv[optind];
+    const char* keyPath = argv[optind + 1];
+    const char* port = argv[optind + 2];
+    if (binary && alphabet != 0)
+        error(1, "--binary can't be used with --alphabet");
+    // The handshake names the direction, the last byte is the alphabet
+    char id[4] = "dec";
+    if (binary)
+        strcpy(id, "xor");
+    id[3] = alphabet;
+    // Spans are written when the client exits, see trace.h
+    traceInit();
+    if (batch) {
+        if (binary || streams > 1 || outputPath)
+            error(1, "--batch can't be used with --binary, --streams or --output");
+        transformBatch(ciphertextPath, keyPath, atoi(port), trusted, alphabet);
+        return 0;
+    }
+    if (streams > 1 || outputPath) {
+        // Results go straight into the output file at their offsets
+        int outputFD = STDOUT_FILENO;
+        if (outputPath) {
+            outputFD = open(outputPath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (outputFD < 0)
+                error(1, "Cannot open output file");
+        }
+        // The files are mapped rather than read, each child only touches its own segment
+        off_t len, keyLen;
+        const char* ciphertext = mapFilePath(ciphertextPath, &len, binary);
+        const char* key = mapFilePath(keyPath, &keyLen, binary);
+        if ((binary || !trusted) && keyLen < len)
+            error(1, "Key is shorter than ciphertext");
+        transformStreams(ciphertext, len, key, keyLen, streams, port, outputFD, id, binary, trusted);
+        close(outputFD);
+        return 0;
+    }
+    char* plaintext;
+    char* key;
+    int len, keyLen;
+    TRACE_BEGIN(readStart);
+    if (binary) {
+        // Files are sent as is, no newline stripping or character checks
+        plaintext = receiveRawFilePath(ciphertextPath, &len);
+        key = receiveRawFilePath(keyPath, &keyLen);
+        if (keyLen < len)
+            error(1, "Key is shorter than ciphertext");
+    } else if (trusted) {
+        // The server checks the characters and key length in the same pass as the transform
+        plaintext = receiveTrustedFilePath(ciphertextPath);
+        key = receiveTrustedFilePath(keyPath);
+    } else {
+        // Calls receiveFilePath() to read the ciphertext file
+        plaintext = receiveFilePath(ciphertextPath, alphabet);
+        // Calls receiveFilePath() to read the key file
+        key = receiveFilePath(keyPath, alphabet);
+        if (strlen(key) < strlen(plaintext))
+            error(1, "Key is shorter than ciphertext");
+    }
+    if (!binary) {
+        len = strlen(plaintext);
+        keyLen = strlen(key);
+    }
+    TRACE_END("readFile", readStart);
+    socketFD = connectServer(atoi(port), id);
+    sendDataLength(socketFD, plaintext, len);
+    sendDataLength(socketFD, key, keyLen);
     // Prints the encrypted ciphertext 
-    char* encrypted = receiveData(socketFD);
-    printf("%s\n", encrypted);
+    int resultLen;
+    char* encrypted = receiveData(socketFD, &resultLen);
+    if (binary) {
+        // Binary output is written as is, without a newline
+        fwrite(encrypted, 1, resultLen, stdout);
+    } else {
+        printf("%s\n", encrypted);
+    }
 
     free(plaintext);
     free(key);
@@ -1,30 +1,51 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <getopt.h>
+#include "alphabet.h"
 
 int main(int argc, char *argv[]) {
-    // Checks whether exactly one argument, program name was provided 
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s keylength\n", argv[0]);
+    // --alphabet picks one of the alphabets in alphabets.def, uppercase and a space by default
+    int alphabet = 0;
+    static struct option options[] = {
+        {"alphabet", required_argument, 0, 'a'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "a:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'a':
+                alphabet = alphabetLookup(optarg);
+                if (alphabet < 0) {
+                    fprintf(stderr, "Error: unknown alphabet, see alphabets.def.\n");
+                    return 1;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [--alphabet name] keylength\n", argv[0]);
+                return 1;
+        }
+    }
+    // Checks whether exactly one argument, the key length, was provided
+    if (argc - optind != 1) {
+        fprintf(stderr, "Usage: %s [--alphabet name] keylength\n", argv[0]);
         return 1;
     }
     // Converts the input string to an integer and store it in keyLength
-    int keyLength = atoi(argv[1]);
+    int keyLength = atoi(argv[optind]);
     if (keyLength <= 0) {
         fprintf(stderr, "Error: keylength must be a positive integer.\n");
         return 1;
     }
     // Initializes the random number generator used by rand()
     srand((unsigned int)time(NULL));
-    // The characters in the file generated will be any of the 27 allowed characters
-    const char charset[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ ";
-    // Total number of bytes in the array and null terminator 
-    int charsetSize = sizeof(charset) - 1; 
+    // The characters in the file generated will be any of the characters in the alphabet
+    int charsetSize = alphabetSize(alphabet);
 
     for (int i = 0; i < keyLength; i++) {
         int index = rand() % charsetSize;
-        // Prints a single character from the the charset array at the randomly selected index
-        printf("%c", charset[index]);
+        // Prints the character the randomly selected number stands for
+        printf("%c", alphabetSymbol(alphabet, index));
 
     }
     printf("\n");
@@ -0,0 +1,395 @@
+// SCHED_IDLE, fallocate(), FALLOC_FL_PUNCH_HOLE and memfd_create() need _GNU_SOURCE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "alphabet.h"
+
+/**
+* Key pad pool
+* keypool serve keeps pad generated ahead of time so getting a key doesn't wait on keygen.
+* 1. Low priority threads generate pad the same way keygen does and append it to the pad file,
+*    keeping --pool bytes ready.
+* 2. A client asks over a UNIX socket for a length. Its region of the pad is copied into
+*    a sealed memfd and the client gets that descriptor, so it can read its own key and
+*    nothing else of the pad.
+* 3. Offsets only move forward, so no byte of pad is ever handed out twice, even across
+*    restarts: a restarted pool starts after everything already in the file.
+* 4. Once a region is copied out it is deleted from the pad file with a hole punch, in
+*    batches of CHUNK_SIZE, so the file stays sparse and holds only pad not handed out.
+*
+* keypool get is a client, it prints a key the way keygen does.
+*
+* Protocol, over a stream UNIX socket:
+* the client sends the length it wants as an int, any number of times on one connection.
+* The reply is a struct padRegion. When length is more than 0 a descriptor holding just
+* the key, from its start, is attached with SCM_RIGHTS. The client closes it when it has
+* read the key.
+*/
+
+// Pad is generated and written in chunks of this many bytes
+#define CHUNK_SIZE (1 << 20)
+#define MAX_THREADS 64
+// Largest key one request can ask for, so a single request can't make the threads
+// fill the disk
+#define MAX_REQUEST (16 * CHUNK_SIZE)
+
+// Sent back for every request
+// offset is where the region was in the pad file, the key itself is in the descriptor
+// length is the number of bytes allocated, or -1 if the request was invalid
+struct padRegion {
+    long offset;
+    int length;
+};
+
+// Print formatted error message and exit with status code
+void error(int exitCode, const char *message) {
+    fprintf(stderr, "keypool error: %s\n", message);
+    exit(exitCode);
+}
+
+// Pad file offsets, every one of them only grows
+// punched <= copied <= allocated, generated <= claimed, and allocated can be past
+// generated while clients wait for their pad
+struct padPool {
+    pthread_mutex_t lock;
+    // Signalled when allocations leave the pool short
+    pthread_cond_t refill;
+    // Signalled when generated or copied moves forward
+    pthread_cond_t ready;
+    int fd;
+    int alphabet;
+    long poolSize;
+    // End of the pad reserved for clients
+    long allocated;
+    // End of the pad fully written to the file, in order
+    long generated;
+    // End of the pad a thread has started generating
+    long claimed;
+    // End of the pad copied out to clients, in order
+    long copied;
+    // Pad before this is deleted
+    long punched;
+};
+
+struct padPool pool = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .refill = PTHREAD_COND_INITIALIZER,
+    .ready = PTHREAD_COND_INITIALIZER,
+};
+
+// Same generator as keygen.c, a random character of the alphabet for every byte
+// rand_r() keeps each thread's state apart so the threads don't share a lock
+void generatePad(char* buffer, int len, int alphabet, unsigned int* seed) {
+    int charsetSize = alphabetSize(alphabet);
+    for (int i = 0; i < len; i++) {
+        buffer[i] = alphabetSymbol(alphabet, rand_r(seed) % charsetSize);
+    }
+}
+
+// Writes all of buffer at offset in fd
+void writeAll(int fd, const char* buffer, int len, long offset) {
+    int totalWritten = 0;
+    while (totalWritten < len) {
+        ssize_t written = pwrite(fd, buffer + totalWritten, len - totalWritten, offset + totalWritten);
+        if (written < 0)
+            error(1, "Cannot write pad file");
+        totalWritten += written;
+    }
+}
+
+// Generates pad whenever the pool has less than it should
+// Threads generate their chunks in parallel but add them to the pool in order
+void* refillThread(void* arg) {
+    unsigned int seed = (unsigned int)(time(NULL) ^ (long)arg ^ getpid());
+    // Runs only when nothing else wants the CPU
+    struct sched_param param = {0};
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+    char* buffer = malloc(CHUNK_SIZE);
+    if (!buffer)
+        error(1, "Memory allocation failed");
+    pthread_mutex_lock(&pool.lock);
+    while (1) {
+        if (pool.claimed - pool.allocated >= pool.poolSize) {
+            pthread_cond_wait(&pool.refill, &pool.lock);
+            continue;
+        }
+        long start = pool.claimed;
+        pool.claimed += CHUNK_SIZE;
+        pthread_mutex_unlock(&pool.lock);
+        generatePad(buffer, CHUNK_SIZE, pool.alphabet, &seed);
+        writeAll(pool.fd, buffer, CHUNK_SIZE, start);
+        pthread_mutex_lock(&pool.lock);
+        // Waits for the chunks before this one so the pool has no gaps
+        while (pool.generated != start)
+            pthread_cond_wait(&pool.ready, &pool.lock);
+        pool.generated += CHUNK_SIZE;
+        pthread_cond_broadcast(&pool.ready);
+    }
+    return NULL;
+}
+
+// Hands out the next len bytes of pad, waiting if the pool doesn't have that many yet
+// Returns the offset of the region
+long allocatePad(int len) {
+    pthread_mutex_lock(&pool.lock);
+    // The region is reserved before waiting, so requests are served in order and
+    // the threads keep generating until poolSize bytes past every reservation
+    long offset = pool.allocated;
+    pool.allocated += len;
+    pthread_cond_broadcast(&pool.refill);
+    while (pool.generated < offset + len)
+        pthread_cond_wait(&pool.ready, &pool.lock);
+    pthread_mutex_unlock(&pool.lock);
+    return offset;
+}
+
+// Copies a region of the pad into a memfd that is sealed so the client can't change it
+// Returns the descriptor, or -1 if it can't be made
+int copyRegion(long offset, int len) {
+    int fd = memfd_create("keypool", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0)
+        return -1;
+    off_t from = offset;
+    long copied = 0;
+    while (copied < len) {
+        ssize_t sent = sendfile(fd, pool.fd, &from, len - copied);
+        if (sent <= 0) {
+            close(fd);
+            return -1;
+        }
+        copied += sent;
+    }
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Marks a region as copied out, whether or not the copy worked
+// Regions are released in the order they were allocated, so the pad before copied is
+// never needed again and is deleted
+void releasePad(long offset, int len) {
+    pthread_mutex_lock(&pool.lock);
+    while (pool.copied != offset)
+        pthread_cond_wait(&pool.ready, &pool.lock);
+    pool.copied = offset + len;
+    pthread_cond_broadcast(&pool.ready);
+    long punchStart = pool.punched;
+    long punchEnd = pool.copied;
+    int punch = (punchEnd - punchStart >= CHUNK_SIZE);
+    if (punch)
+        pool.punched = punchEnd;
+    pthread_mutex_unlock(&pool.lock);
+    if (punch)
+        fallocate(pool.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, punchStart, punchEnd - punchStart);
+}
+
+// Answers every request on one client connection
+void* clientThread(void* arg) {
+    int connectionSocket = (int)(long)arg;
+    int len;
+    while (recv(connectionSocket, &len, sizeof(len), MSG_WAITALL) == sizeof(len)) {
+        struct padRegion region = {0, -1};
+        int regionFD = -1;
+        if (len > 0 && len <= MAX_REQUEST) {
+            region.offset = allocatePad(len);
+            regionFD = copyRegion(region.offset, len);
+            releasePad(region.offset, len);
+            if (regionFD >= 0)
+                region.length = len;
+        }
+        struct iovec part = {&region, sizeof(region)};
+        // The descriptor holding the key goes along with the region
+        union {
+            struct cmsghdr header;
+            char space[CMSG_SPACE(sizeof(int))];
+        } control;
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = &part;
+        message.msg_iovlen = 1;
+        if (region.length > 0) {
+            message.msg_control = control.space;
+            message.msg_controllen = sizeof(control.space);
+            struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(cmsg), &regionFD, sizeof(int));
+        }
+        int sent = sendmsg(connectionSocket, &message, MSG_NOSIGNAL);
+        // The client has its own copy of the descriptor now
+        if (regionFD >= 0)
+            close(regionFD);
+        if (sent < 0)
+            break;
+    }
+    close(connectionSocket);
+    return NULL;
+}
+
+// Runs the pool until it is killed
+void servePool(const char* padPath, const char* socketPath, int threads) {
+    pool.fd = open(padPath, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (pool.fd < 0)
+        error(1, "Cannot open pad file");
+    struct stat info;
+    if (fstat(pool.fd, &info) < 0)
+        error(1, "Cannot read pad file");
+    // Everything already in the file may have been handed out before a restart,
+    // so it is deleted and the pool starts after it
+    pool.allocated = pool.generated = pool.claimed = pool.copied = pool.punched = info.st_size;
+    if (info.st_size > 0)
+        fallocate(pool.fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, info.st_size);
+
+    int listenSocket = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listenSocket < 0)
+        error(1, "Cannot open socket");
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path))
+        error(1, "Socket path is too long");
+    strcpy(address.sun_path, socketPath);
+    // A socket left behind by a pool that was killed is replaced
+    unlink(socketPath);
+    if (bind(listenSocket, (struct sockaddr*)&address, sizeof(address)) < 0)
+        error(1, "Cannot bind socket");
+    if (listen(listenSocket, 64) < 0)
+        error(1, "Cannot listen on socket");
+
+    pthread_t id;
+    for (long i = 0; i < threads; i++) {
+        if (pthread_create(&id, NULL, refillThread, (void*)i) != 0)
+            error(1, "Cannot start thread");
+    }
+    while (1) {
+        int connectionSocket = accept4(listenSocket, NULL, NULL, SOCK_CLOEXEC);
+        if (connectionSocket < 0) {
+            if (errno == EINTR)
+                continue;
+            error(1, "Cannot accept connection");
+        }
+        if (pthread_create(&id, NULL, clientThread, (void*)(long)connectionSocket) != 0) {
+            close(connectionSocket);
+            continue;
+        }
+        pthread_detach(id);
+    }
+}
+
+// Asks the pool for len bytes of pad and prints them with a newline, like keygen
+void getPad(const char* socketPath, int len) {
+    int socketFD = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (socketFD < 0)
+        error(1, "Cannot open socket");
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(socketPath) >= sizeof(address.sun_path))
+        error(1, "Socket path is too long");
+    strcpy(address.sun_path, socketPath);
+    if (connect(socketFD, (struct sockaddr*)&address, sizeof(address)) < 0)
+        error(1, "Cannot connect to pool");
+    if (send(socketFD, &len, sizeof(len), 0) != sizeof(len))
+        error(1, "Cannot send request");
+    struct padRegion region;
+    struct iovec part = {&region, sizeof(region)};
+    union {
+        struct cmsghdr header;
+        char space[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &part;
+    message.msg_iovlen = 1;
+    message.msg_control = control.space;
+    message.msg_controllen = sizeof(control.space);
+    if (recvmsg(socketFD, &message, MSG_WAITALL) != sizeof(region) || region.length != len)
+        error(1, "Pool rejected request");
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    if (!cmsg || cmsg->cmsg_type != SCM_RIGHTS)
+        error(1, "Pool sent no key");
+    int keyFD;
+    memcpy(&keyFD, CMSG_DATA(cmsg), sizeof(int));
+    close(socketFD);
+    char buffer[65536];
+    long totalRead = 0;
+    while (totalRead < len) {
+        int wanted = (len - totalRead < (long)sizeof(buffer)) ? len - totalRead : (int)sizeof(buffer);
+        ssize_t charsRead = pread(keyFD, buffer, wanted, totalRead);
+        if (charsRead <= 0)
+            error(1, "Cannot read pad file");
+        fwrite(buffer, 1, charsRead, stdout);
+        totalRead += charsRead;
+    }
+    printf("\n");
+    close(keyFD);
+}
+
+int main(int argc, char* argv[]) {
+    // --alphabet is the alphabet of the pad, --pool how many bytes to keep ready
+    // --threads how many threads generate pad
+    int alphabet = 0;
+    long poolSize = 64L * CHUNK_SIZE;
+    int threads = 2;
+    static struct option options[] = {
+        {"alphabet", required_argument, 0, 'a'},
+        {"pool", required_argument, 0, 'p'},
+        {"threads", required_argument, 0, 'j'},
+        {0, 0, 0, 0}
+    };
+    const char* usage = "Usage: ./keypool [--alphabet name] [--pool bytes] [--threads N] serve <pad file> <socket>\n"
+                        "       ./keypool get <socket> <keylength>";
+    int opt;
+    while ((opt = getopt_long(argc, argv, "a:p:j:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'a':
+                alphabet = alphabetLookup(optarg);
+                if (alphabet < 0)
+                    error(1, "Unknown alphabet, see alphabets.def");
+                break;
+            case 'p':
+                poolSize = atol(optarg);
+                if (poolSize < CHUNK_SIZE)
+                    poolSize = CHUNK_SIZE;
+                break;
+            case 'j':
+                threads = atoi(optarg);
+                if (threads < 1 || threads > MAX_THREADS)
+                    error(1, "--threads must be between 1 and 64");
+                break;
+            default:
+                error(1, usage);
+        }
+    }
+    if (argc - optind == 3 && strcmp(argv[optind], "serve") == 0) {
+        pool.alphabet = alphabet;
+        pool.poolSize = poolSize;
+        servePool(argv[optind + 1], argv[optind + 2], threads);
+    } else if (argc - optind == 3 && strcmp(argv[optind], "get") == 0) {
+        int len = atoi(argv[optind + 2]);
+        if (len <= 0 || len > MAX_REQUEST)
+            error(1, "keylength must be between 1 and 16777216");
+        getPad(argv[optind + 1], len);
+    } else {
+        error(1, usage);
+    }
+    return 0;
+}
@@ -0,0 +1,274 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "alphabet.h"
+
+/**
+* Local mode
+* Runs the same transform as otp_server without a server or sockets.
+* 1. Map the text and key files into memory.
+* 2. Split both files between threads, each one counts the newlines in its parts.
+* 3. Size the output file from the counts and map it too.
+* 4. Each thread transforms its part of the text, skipping newlines in the text and key
+*    like the clients leave them out, and writes its output in place.
+*/
+
+// Inputs smaller than this per thread are not worth starting another thread for
+#define MIN_BYTES_PER_THREAD (1 << 20)
+#define MAX_THREADS 64
+
+// Print formatted error message and exit with status code
+void error(int exitCode, const char *message) {
+    fprintf(stderr, "otp error: %s\n", message);
+    exit(exitCode);
+}
+
+// The part of the text one thread transforms
+// Positions are in the files, newlines included, unless said otherwise
+struct transformJob {
+    const char* text;
+    const char* key;
+    size_t keyLen;
+    char* result;
+    // The part of the text this thread transforms
+    size_t start;
+    size_t end;
+    // The part of the key this thread counts newlines in, the same share of the key file
+    size_t keyStart;
+    size_t keyEnd;
+    // Newlines counted in the first pass
+    size_t newlines;
+    size_t keyNewlines;
+    // Set between the passes, where the part's result goes and where its key starts:
+    // keySkip characters that aren't newlines after keyFrom
+    size_t resultOffset;
+    size_t keyFrom;
+    size_t keySkip;
+    int decrypt;
+    int alphabet;
+    // Set by the thread if it found a character that isn't in the alphabet
+    int invalid;
+};
+
+// Position of the next newline from position on, or end if there is none
+size_t nextNewline(const char* data, size_t position, size_t end) {
+    const char* newline = memchr(data + position, '\n', end - position);
+    return newline ? (size_t)(newline - data) : end;
+}
+
+// Position after count characters that aren't newlines, starting from position
+size_t skipCharacters(const char* data, size_t position, size_t end, size_t count) {
+    while (count > 0) {
+        size_t newline = nextNewline(data, position, end);
+        if (newline - position > count || newline == end)
+            return position + count;
+        count -= newline - position;
+        position = newline + 1;
+    }
+    return position;
+}
+
+// First pass, counts the newlines in the thread's part of the text and of the key
+void* countThread(void* arg) {
+    struct transformJob* job = arg;
+    job->newlines = 0;
+    for (size_t i = nextNewline(job->text, job->start, job->end); i < job->end;
+         i = nextNewline(job->text, i + 1, job->end))
+        job->newlines++;
+    job->keyNewlines = 0;
+    for (size_t i = nextNewline(job->key, job->keyStart, job->keyEnd); i < job->keyEnd;
+         i = nextNewline(job->key, i + 1, job->keyEnd))
+        job->keyNewlines++;
+    return NULL;
+}
+
+// Second pass, same kernel as otpTransform in otp_server.c, see alphabet.h
+// It runs over the longest stretches with no newline in the text or the key, so
+// text without newlines is a single call like before
+void* transformThread(void* arg) {
+    struct transformJob* job = arg;
+    size_t t = job->start;
+    size_t k = skipCharacters(job->key, job->keyFrom, job->keyLen, job->keySkip);
+    size_t r = job->resultOffset;
+    size_t textBreak = nextNewline(job->text, t, job->end);
+    size_t keyBreak = nextNewline(job->key, k, job->keyLen);
+    job->invalid = 0;
+    while (t < job->end) {
+        if (t == textBreak) {
+            textBreak = nextNewline(job->text, ++t, job->end);
+            continue;
+        }
+        if (k == keyBreak) {
+            keyBreak = nextNewline(job->key, ++k, job->keyLen);
+            continue;
+        }
+        size_t run = (textBreak - t < keyBreak - k) ? textBreak - t : keyBreak - k;
+        job->invalid |= alphabetKernel(job->alphabet, job->text + t, job->key + k,
+                                       job->result + r, run, job->decrypt);
+        t += run;
+        k += run;
+        r += run;
+    }
+    return NULL;
+}
+
+// Runs fn on every job, the first one on this thread
+void runJobs(void* (*fn)(void*), struct transformJob* jobs, int threads) {
+    pthread_t ids[MAX_THREADS];
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&ids[i], NULL, fn, &jobs[i]) != 0)
+            error(1, "Cannot start thread");
+    }
+    fn(&jobs[0]);
+    for (int i = 1; i < threads; i++)
+        pthread_join(ids[i], NULL);
+}
+
+// Maps a whole file read only
+// The length without the trailing newline is stored in length
+const char* mapFile(const char* filepath, size_t* length) {
+    int fd = open(filepath, O_RDONLY);
+    if (fd < 0)
+        error(1, "Cannot open file");
+    struct stat info;
+    if (fstat(fd, &info) < 0)
+        error(1, "Cannot read file");
+    size_t size = info.st_size;
+    // mmap() can't map an empty file
+    if (size == 0) {
+        close(fd);
+        *length = 0;
+        return "";
+    }
+    const char* data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        error(1, "Cannot map file");
+    // The mapping stays valid after the file is closed
+    close(fd);
+    madvise((void*)data, size, MADV_SEQUENTIAL);
+    // Strip the newline at the end of the file
+    if (data[size - 1] == '\n')
+        size--;
+    *length = size;
+    return data;
+}
+
+int main(int argc, char* argv[]) {
+    // --threads picks how many threads share the work, by default one per CPU
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    // --alphabet picks one of the alphabets in alphabets.def
+    int alphabet = 0;
+    static struct option options[] = {
+        {"threads", required_argument, 0, 'j'},
+        {"alphabet", required_argument, 0, 'a'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:a:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'j':
+                threads = atoi(optarg);
+                break;
+            case 'a':
+                alphabet = alphabetLookup(optarg);
+                if (alphabet < 0)
+                    error(1, "Unknown alphabet, see alphabets.def");
+                break;
+            default:
+                error(1, "Usage: ./otp [--threads N] [--alphabet name] enc|dec <text> <key> <output>");
+        }
+    }
+    // Checks if the user provided the direction, text file, key file and output file
+    if (argc - optind != 4)
+        error(1, "Usage: ./otp [--threads N] [--alphabet name] enc|dec <text> <key> <output>");
+    int decrypt = 0;
+    if (strcmp(argv[optind], "enc") == 0) {
+        decrypt = 0;
+    } else if (strcmp(argv[optind], "dec") == 0) {
+        decrypt = 1;
+    } else {
+        error(1, "Direction must be enc or dec");
+    }
+    size_t len, keyLen;
+    const char* text = mapFile(argv[optind + 1], &len);
+    const char* key = mapFile(argv[optind + 2], &keyLen);
+
+    // Only use as many threads as there is work for
+    if (threads > MAX_THREADS)
+        threads = MAX_THREADS;
+    if ((size_t)threads > len / MIN_BYTES_PER_THREAD)
+        threads = len / MIN_BYTES_PER_THREAD;
+    if (threads < 1)
+        threads = 1;
+    struct transformJob jobs[MAX_THREADS];
+    size_t partSize = (len + threads - 1) / threads;
+    size_t keyPartSize = (keyLen + threads - 1) / threads;
+    for (int i = 0; i < threads; i++) {
+        jobs[i].text = text;
+        jobs[i].key = key;
+        jobs[i].keyLen = keyLen;
+        jobs[i].start = (i * partSize < len) ? i * partSize : len;
+        jobs[i].end = (jobs[i].start + partSize < len) ? jobs[i].start + partSize : len;
+        jobs[i].keyStart = (i * keyPartSize < keyLen) ? i * keyPartSize : keyLen;
+        jobs[i].keyEnd = (jobs[i].keyStart + keyPartSize < keyLen) ? jobs[i].keyStart + keyPartSize : keyLen;
+        jobs[i].decrypt = decrypt;
+        jobs[i].alphabet = alphabet;
+    }
+    runJobs(countThread, jobs, threads);
+
+    // Each part's result starts after the text before it without its newlines
+    size_t textChars = 0, keyChars = 0;
+    for (int i = 0; i < threads; i++) {
+        jobs[i].resultOffset = textChars;
+        textChars += (jobs[i].end - jobs[i].start) - jobs[i].newlines;
+        keyChars += (jobs[i].keyEnd - jobs[i].keyStart) - jobs[i].keyNewlines;
+    }
+    if (keyChars < textChars)
+        error(1, "Key is shorter than text");
+    // Each part's key starts at the same character, the key part holding it is found
+    // from the counts and the thread skips to it inside that part
+    int keyPart = 0;
+    size_t keyPartChars = 0;
+    for (int i = 0; i < threads; i++) {
+        while (keyPart + 1 < threads && keyPartChars + (jobs[keyPart].keyEnd - jobs[keyPart].keyStart)
+               - jobs[keyPart].keyNewlines <= jobs[i].resultOffset) {
+            keyPartChars += (jobs[keyPart].keyEnd - jobs[keyPart].keyStart) - jobs[keyPart].keyNewlines;
+            keyPart++;
+        }
+        jobs[i].keyFrom = jobs[keyPart].keyStart;
+        jobs[i].keySkip = jobs[i].resultOffset - keyPartChars;
+    }
+
+    // The output is sized from the counts and written in place through a shared mapping
+    // One extra byte for the newline at the end, like the clients print
+    int outputFD = open(argv[optind + 3], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (outputFD < 0)
+        error(1, "Cannot open output file");
+    if (ftruncate(outputFD, textChars + 1) < 0)
+        error(1, "Cannot size output file");
+    char* result = mmap(NULL, textChars + 1, PROT_READ | PROT_WRITE, MAP_SHARED, outputFD, 0);
+    if (result == MAP_FAILED)
+        error(1, "Cannot map output file");
+    for (int i = 0; i < threads; i++)
+        jobs[i].result = result;
+    runJobs(transformThread, jobs, threads);
+    int invalid = 0;
+    for (int i = 0; i < threads; i++)
+        invalid |= jobs[i].invalid;
+    result[textChars] = '\n';
+    munmap(result, textChars + 1);
+    close(outputFD);
+    if (invalid) {
+        // Don't leave a half valid result behind
+        unlink(argv[optind + 3]);
+        error(1, "Invalid character in text or key");
+    }
+    return 0;
+}
@@ -0,0 +1,429 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/types.h>  // ssize_t
+#include <sys/socket.h> // send(),recv()
+#include <sys/uio.h>    // struct iovec
+#include <sys/epoll.h>  // epoll_wait()
+#include <netinet/in.h> // struct sockaddr_in
+#include <netdb.h>      // gethostbyname()
+#include "otp_client.h"
+#include "alphabet.h"
+
+// What a connection is doing
+#define CONNECTION_CLOSED 0
+#define CONNECTION_CONNECTING 1
+#define CONNECTION_HANDSHAKE 2
+#define CONNECTION_SENDING 3
+#define CONNECTION_RECEIVING 4
+
+// Most events handled by one call to otpComplete
+#define MAX_EVENTS 64
+
+// A submitted request, the buffers belong to the caller
+struct otpRequest {
+    const char* text;
+    int len;
+    const char* key;
+    int keyLen;
+    char* result;
+    int resultCapacity;
+    otpCallback callback;
+    void* arg;
+    struct otpRequest* next;
+};
+
+struct otpConnection {
+    int socketFD;
+    int state;
+    // Bytes of the current step sent or received so far
+    int done;
+    char handshake[4];
+    // Length at the start of the reply, negative for an error code
+    int replyLength;
+    struct otpRequest* request;
+};
+
+struct otpPool {
+    int epollFD;
+    struct sockaddr_in address;
+    // Handshake identifier, 3 characters and the alphabet
+    char id[4];
+    // Most connections open at once
+    int size;
+    // Connections that aren't closed
+    int live;
+    int pending;
+    struct otpConnection* connections;
+    // Requests waiting for a free connection, oldest first
+    struct otpRequest* queueHead;
+    struct otpRequest* queueTail;
+};
+
+// From client.c
+// Set up the address struct, returns 0 if the host can't be found
+static int setupAddressStruct(struct sockaddr_in* address,
+                              int portNumber,
+                              const char* hostname) {
+    // Clear out the address struct
+    memset(address, 0, sizeof(*address));
+    // The address should be network capable
+    address->sin_family = AF_INET;
+    // Store the port number
+    address->sin_port = htons(portNumber);
+    // Get the DNS entry for this host name
+    struct hostent* hostInfo = gethostbyname(hostname);
+    if (hostInfo == NULL)
+        return 0;
+    // Copy the first IP address from the DNS entry to sin_addr.s_addr
+    memcpy((char*) &address->sin_addr.s_addr,
+        hostInfo->h_addr_list[0],
+        hostInfo->h_length);
+    return 1;
+}
+
+// Changes which events epoll reports for a connection
+static void watchConnection(struct otpPool* pool, struct otpConnection* connection, int events) {
+    struct epoll_event event;
+    event.events = events;
+    event.data.ptr = connection;
+    epoll_ctl(pool->epollFD, EPOLL_CTL_MOD, connection->socketFD, &event);
+}
+
+// Starts a new connection for a request without waiting for it to connect
+// Returns 0 if the connection can't be started
+static int openConnection(struct otpPool* pool, struct otpConnection* connection,
+                          struct otpRequest* request) {
+    int socketFD = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (socketFD < 0)
+        return 0;
+    if (connect(socketFD, (struct sockaddr*)&pool->address, sizeof(pool->address)) < 0
+        && errno != EINPROGRESS) {
+        close(socketFD);
+        return 0;
+    }
+    struct epoll_event event;
+    // Writable once the connection is made
+    event.events = EPOLLOUT;
+    event.data.ptr = connection;
+    if (epoll_ctl(pool->epollFD, EPOLL_CTL_ADD, socketFD, &event) < 0) {
+        close(socketFD);
+        return 0;
+    }
+    connection->socketFD = socketFD;
+    connection->state = CONNECTION_CONNECTING;
+    connection->done = 0;
+    connection->request = request;
+    pool->live++;
+    return 1;
+}
+
+// Closing the socket also takes it out of the epoll set
+static void closeConnection(struct otpPool* pool, struct otpConnection* connection) {
+    close(connection->socketFD);
+    connection->socketFD = -1;
+    connection->state = CONNECTION_CLOSED;
+    connection->request = NULL;
+    pool->live--;
+}
+
+// Runs a request's callback and frees it
+static void finishRequest(struct otpPool* pool, struct otpRequest* request, int status, int length) {
+    pool->pending--;
+    request->callback(request->arg, status, length);
+    free(request);
+}
+
+// Fails every queued request, for when no connection is left to run them
+static int failQueue(struct otpPool* pool, int status) {
+    int finished = 0;
+    while (pool->queueHead) {
+        struct otpRequest* request = pool->queueHead;
+        pool->queueHead = request->next;
+        finishRequest(pool, request, status, 0);
+        finished++;
+    }
+    pool->queueTail = NULL;
+    return finished;
+}
+
+// Puts a request back at the front of the queue
+static void requeueRequest(struct otpPool* pool, struct otpRequest* request) {
+    request->next = pool->queueHead;
+    pool->queueHead = request;
+    if (!pool->queueTail)
+        pool->queueTail = request;
+}
+
+// Opens a connection for each queued request while there are free slots
+// A request whose connection can't be started stays queued for the next call
+static void dispatchRequests(struct otpPool* pool) {
+    for (int i = 0; i < pool->size && pool->queueHead; i++) {
+        struct otpConnection* connection = &pool->connections[i];
+        if (connection->state != CONNECTION_CLOSED)
+            continue;
+        struct otpRequest* request = pool->queueHead;
+        pool->queueHead = request->next;
+        if (!pool->queueHead)
+            pool->queueTail = NULL;
+        if (!openConnection(pool, connection, request)) {
+            requeueRequest(pool, request);
+            return;
+        }
+    }
+}
+
+struct otpPool* otpPoolCreate(const char* hostname, int port, const char* mode,
+                              const char* alphabet, int connections) {
+    int alphabetId = alphabet ? alphabetLookup(alphabet) : 0;
+    // Byte mode has no alphabet
+    if (connections < 1 || strlen(mode) != 3 || alphabetId < 0
+        || (alphabetId != 0 && strcmp(mode, "xor") == 0))
+        return NULL;
+    struct otpPool* pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return NULL;
+    pool->connections = calloc(connections, sizeof(*pool->connections));
+    pool->epollFD = epoll_create1(EPOLL_CLOEXEC);
+    if (!pool->connections || pool->epollFD < 0
+        || !setupAddressStruct(&pool->address, port, hostname)) {
+        if (pool->epollFD >= 0)
+            close(pool->epollFD);
+        free(pool->connections);
+        free(pool);
+        return NULL;
+    }
+    memcpy(pool->id, mode, 3);
+    pool->id[3] = alphabetId;
+    pool->size = connections;
+    for (int i = 0; i < connections; i++) {
+        pool->connections[i].socketFD = -1;
+        pool->connections[i].state = CONNECTION_CLOSED;
+    }
+    return pool;
+}
+
+void otpPoolDestroy(struct otpPool* pool) {
+    for (int i = 0; i < pool->size; i++) {
+        struct otpConnection* connection = &pool->connections[i];
+        if (connection->state == CONNECTION_CLOSED)
+            continue;
+        free(connection->request);
+        closeConnection(pool, connection);
+    }
+    while (pool->queueHead) {
+        struct otpRequest* request = pool->queueHead;
+        pool->queueHead = request->next;
+        free(request);
+    }
+    close(pool->epollFD);
+    free(pool->connections);
+    free(pool);
+}
+
+int otpPoolFD(struct otpPool* pool) {
+    return pool->epollFD;
+}
+
+int otpPending(struct otpPool* pool) {
+    return pool->pending;
+}
+
+int otpSubmit(struct otpPool* pool, const char* text, int len, const char* key, int keyLen,
+              char* result, int resultCapacity, otpCallback callback, void* arg) {
+    if (len < 0 || keyLen < 0 || resultCapacity < len || !callback)
+        return -1;
+    struct otpRequest* request = malloc(sizeof(*request));
+    if (!request)
+        return -1;
+    request->text = text;
+    request->len = len;
+    request->key = key;
+    request->keyLen = keyLen;
+    request->result = result;
+    request->resultCapacity = resultCapacity;
+    request->callback = callback;
+    request->arg = arg;
+    request->next = NULL;
+    if (pool->queueTail)
+        pool->queueTail->next = request;
+    else
+        pool->queueHead = request;
+    pool->queueTail = request;
+    pool->pending++;
+    dispatchRequests(pool);
+    return 0;
+}
+
+// Sends as much of the request as the socket takes
+// Both messages go out in one sendmsg() straight from the caller's buffers
+// Returns 1 when all of it is sent, 0 if the socket is full, -1 if the connection failed
+static int sendRequest(struct otpConnection* connection) {
+    struct otpRequest* request = connection->request;
+    struct iovec parts[4] = {
+        {&request->len, sizeof(request->len)},
+        {(void*)request->text, request->len},
+        {&request->keyLen, sizeof(request->keyLen)},
+        {(void*)request->key, request->keyLen}
+    };
+    int total = 2 * sizeof(int) + request->len + request->keyLen;
+    while (connection->done < total) {
+        // Skips the parts that were sent by an earlier call
+        int first = 0;
+        int skip = connection->done;
+        while (skip >= (int)parts[first].iov_len) {
+            skip -= parts[first].iov_len;
+            first++;
+        }
+        struct iovec remaining[4];
+        int count = 0;
+        for (int i = first; i < 4; i++)
+            remaining[count++] = parts[i];
+        remaining[0].iov_base = (char*)remaining[0].iov_base + skip;
+        remaining[0].iov_len -= skip;
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        message.msg_iov = remaining;
+        message.msg_iovlen = count;
+        ssize_t charsWritten = sendmsg(connection->socketFD, &message, MSG_NOSIGNAL);
+        if (charsWritten < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        connection->done += charsWritten;
+    }
+    return 1;
+}
+
+// Receives as much of the reply as has arrived
+// The length goes into replyLength, the result straight into the caller's buffer
+// Returns 1 when the reply is complete, 0 if more is to come, -1 if the connection failed
+static int receiveReply(struct otpConnection* connection) {
+    struct otpRequest* request = connection->request;
+    while (1) {
+        char* buffer;
+        int wanted;
+        if (connection->done < (int)sizeof(int)) {
+            buffer = (char*)&connection->replyLength + connection->done;
+            wanted = sizeof(int) - connection->done;
+        } else {
+            // A negative length is an error code, the message after it isn't needed
+            if (connection->replyLength < 0)
+                return 1;
+            if (connection->replyLength > request->resultCapacity)
+                return 1;
+            int received = connection->done - sizeof(int);
+            if (received == connection->replyLength)
+                return 1;
+            buffer = request->result + received;
+            wanted = connection->replyLength - received;
+        }
+        ssize_t charsRead = recv(connection->socketFD, buffer, wanted, 0);
+        if (charsRead < 0)
+            return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+        if (charsRead == 0)
+            return -1;
+        connection->done += charsRead;
+    }
+}
+
+// Moves one connection forward after epoll reported it ready
+// Returns how many requests finished
+static int handleConnection(struct otpPool* pool, struct otpConnection* connection) {
+    struct otpRequest* request = connection->request;
+    int status, result;
+    switch (connection->state) {
+        case CONNECTION_CONNECTING: {
+            int socketError = 0;
+            socklen_t size = sizeof(socketError);
+            getsockopt(connection->socketFD, SOL_SOCKET, SO_ERROR, &socketError, &size);
+            // The identifier is 4 bytes so it always fits in a new socket's buffer
+            if (socketError != 0
+                || send(connection->socketFD, pool->id, sizeof(pool->id), MSG_NOSIGNAL) != sizeof(pool->id)) {
+                closeConnection(pool, connection);
+                finishRequest(pool, request, OTP_ERROR_CONNECTION, 0);
+                return 1;
+            }
+            connection->state = CONNECTION_HANDSHAKE;
+            connection->done = 0;
+            watchConnection(pool, connection, EPOLLIN);
+            return 0;
+        }
+        case CONNECTION_HANDSHAKE: {
+            ssize_t charsRead = recv(connection->socketFD, connection->handshake + connection->done,
+                                     sizeof(connection->handshake) - connection->done, 0);
+            if (charsRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return 0;
+            if (charsRead <= 0) {
+                closeConnection(pool, connection);
+                finishRequest(pool, request, OTP_ERROR_CONNECTION, 0);
+                return 1;
+            }
+            connection->done += charsRead;
+            if (connection->done < (int)sizeof(connection->handshake))
+                return 0;
+            // Compares the identifier with the received response
+            if (strncmp(pool->id, connection->handshake, sizeof(pool->id)) != 0) {
+                closeConnection(pool, connection);
+                finishRequest(pool, request, OTP_ERROR_REJECTED, 0);
+                // The server will never take this mode, so queued requests can't run either
+                return 1 + failQueue(pool, OTP_ERROR_REJECTED);
+            }
+            connection->state = CONNECTION_SENDING;
+            connection->done = 0;
+            // Sending starts as soon as epoll reports the socket writable
+            watchConnection(pool, connection, EPOLLOUT);
+            return 0;
+        }
+        case CONNECTION_SENDING:
+            result = sendRequest(connection);
+            if (result == 0)
+                return 0;
+            if (result < 0) {
+                closeConnection(pool, connection);
+                finishRequest(pool, request, OTP_ERROR_CONNECTION, 0);
+                return 1;
+            }
+            connection->state = CONNECTION_RECEIVING;
+            connection->done = 0;
+            watchConnection(pool, connection, EPOLLIN);
+            return 0;
+        case CONNECTION_RECEIVING:
+            result = receiveReply(connection);
+            if (result == 0)
+                return 0;
+            if (result < 0) {
+                status = OTP_ERROR_CONNECTION;
+            } else if (connection->replyLength < 0) {
+                status = -connection->replyLength;
+            } else if (connection->replyLength > request->resultCapacity) {
+                status = OTP_ERROR_RESULT_TOO_LARGE;
+            } else {
+                status = OTP_OK;
+            }
+            int length = (status == OTP_OK) ? connection->replyLength : 0;
+            // The server is done with this connection, the slot goes to the next request
+            closeConnection(pool, connection);
+            finishRequest(pool, request, status, length);
+            return 1;
+    }
+    return 0;
+}
+
+int otpComplete(struct otpPool* pool, int timeout) {
+    int finished = 0;
+    // Queued requests whose connections couldn't be started are tried again
+    dispatchRequests(pool);
+    // Nothing can run the queued requests if no connection can be opened
+    if (pool->live == 0)
+        return failQueue(pool, OTP_ERROR_CONNECTION);
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(pool->epollFD, events, MAX_EVENTS, timeout);
+    for (int i = 0; i < count; i++)
+        finished += handleConnection(pool, events[i].data.ptr);
+    // Slots freed by finished requests take the next ones
+    dispatchRequests(pool);
+    if (pool->live == 0)
+        finished += failQueue(pool, OTP_ERROR_CONNECTION);
+    return finished;
+}
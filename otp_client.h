@@ -0,0 +1,70 @@
+#ifndef OTP_CLIENT_H
+#define OTP_CLIENT_H
+
+/**
+* Client library
+* The client logic of enc_client and dec_client for programs that send many requests.
+* 1. otpPoolCreate sets up a pool that runs up to a number of requests at once.
+* 2. otpSubmit queues a request, it gets its own connection as soon as a slot is free.
+* 3. otpComplete connects, sends and receives on every connection without blocking on
+*    any one of them, and calls each request's callback when the server has answered.
+*
+* Buffers belong to the caller and are used in place, the text and key are sent
+* straight from them and the result is received straight into the result buffer.
+* They have to stay valid until the callback runs.
+*
+* Connections are only opened for a request and closed when it finishes. The server
+* forks a worker per connection and answers one request on it, so a connection kept
+* open ahead of time would hold one of its few workers while doing nothing and lock
+* out other clients. Each request pays for the connect and handshake round trips
+* instead. A pool size below the server's worker count (5) leaves room for others.
+*
+* A pool is not thread safe, use one pool per thread.
+*/
+
+// Statuses passed to the callback
+// The server's reply codes are passed as is, and are more than 0
+#define OTP_OK 0
+#define OTP_REPLY_INVALID_CHARACTER 1
+#define OTP_REPLY_KEY_TOO_SHORT 2
+// The connection failed or the server closed it before answering
+#define OTP_ERROR_CONNECTION -1
+// The server doesn't accept the mode the pool was opened with
+#define OTP_ERROR_REJECTED -2
+// The result is bigger than the result buffer
+#define OTP_ERROR_RESULT_TOO_LARGE -3
+
+struct otpPool;
+
+// Called once per request with its status and, on success, the length of the result
+// The result is not null terminated
+typedef void (*otpCallback)(void* arg, int status, int length);
+
+// Sets up a pool for hostname:port, mode is "enc", "dec" or "xor"
+// At most connections requests are sent at once, each on its own connection
+// alphabet is a name from alphabets.def, or NULL for the default
+// Returns NULL if the host can't be found, the alphabet is unknown or memory runs out
+struct otpPool* otpPoolCreate(const char* hostname, int port, const char* mode,
+                              const char* alphabet, int connections);
+
+// Closes every connection, requests that haven't finished are dropped without a callback
+void otpPoolDestroy(struct otpPool* pool);
+
+// A file descriptor that is readable when otpComplete has work to do,
+// for callers that wait in their own poll(), epoll or event loop
+int otpPoolFD(struct otpPool* pool);
+
+// Queues a request, result needs room for at least len bytes
+// Returns 0, or -1 if the request can't be queued
+int otpSubmit(struct otpPool* pool, const char* text, int len, const char* key, int keyLen,
+              char* result, int resultCapacity, otpCallback callback, void* arg);
+
+// Makes progress on every connection, waiting up to timeout milliseconds for one
+// to be ready, -1 waits until one is, 0 doesn't wait
+// Returns how many requests finished, their callbacks have run
+int otpComplete(struct otpPool* pool, int timeout);
+
+// Requests submitted that haven't finished yet
+int otpPending(struct otpPool* pool);
+
+#endif
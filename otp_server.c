@@ -0,0 +1,983 @@
+// sched_setaffinity() and cpu_set_t need _GNU_SOURCE
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <dirent.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <sys/time.h>
+#include <signal.h>
+#include <errno.h>
+#include <getopt.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include "trace.h"
+#include "alphabet.h"
+
+// One server for both directions, the handshake picks encrypt or decrypt
+// Both directions share the MAX_CHILDREN workers and the metrics
+// enc_server and dec_server are built from this file with SERVER_MODES
+// set to a single direction, see compileall
+
+#define BUFFER_CAPACITY 1000
+#define MAX_CHILDREN 5
+// Longest the parent waits for a connection before going round its loop,
+// so the children's spans are flushed even when no connection comes in
+#define FLUSH_INTERVAL_MS 1000
+
+// Directions a connection can ask for in the handshake
+// MODE_XOR is the byte mode for binary data, XOR is its own inverse so it
+// covers both directions and the single direction builds accept it too
+#define MODE_ENC 1
+#define MODE_DEC 2
+#define MODE_XOR 4
+
+// Directions this build accepts
+#ifndef SERVER_MODES
+#define SERVER_MODES (MODE_ENC | MODE_DEC | MODE_XOR)
+#endif
+
+// Error codes sent back to the client in place of a result
+#define REPLY_INVALID_CHARACTER 1
+#define REPLY_KEY_TOO_SHORT 2
+#define REPLY_INVALID_BATCH 3
+
+// Sent in place of a message length to start a batch request, see otpBatchTransform
+// The reply to a batch starts with it too, it is well below any negative error code
+#define BATCH_REQUEST -1000
+
+// Exit status of a child whose connection ran out of time
+// The parent counts these when it reaps the child
+#define EXIT_HANDSHAKE_TIMEOUT 3
+#define EXIT_IDLE_TIMEOUT 4
+#define EXIT_REQUEST_TIMEOUT 5
+
+// Deadlines in seconds, 0 turns a deadline off
+// handshake: time allowed for the client to send its handshake
+// idle: time allowed for any single recv() or send() to make progress
+// request: time allowed for the whole connection from accept to reply
+int handshakeTimeout = 5;
+int idleTimeout = 10;
+int requestTimeout = 60;
+
+// Counters for the whole server
+// Kept in shared memory so the children can count the requests they handle
+// Every update is atomic since children and the parent write at the same time
+struct serverMetrics {
+    long encryptRequests;
+    long decryptRequests;
+    long xorRequests;
+    long batchRequests;
+    long batchRecords;
+    long rejectedClients;
+    long errorReplies;
+    // Number of connections that hit each deadline
+    long handshakeTimeouts;
+    long idleTimeouts;
+    long requestTimeouts;
+};
+struct serverMetrics* metrics;
+
+// Worker placement, nothing is pinned unless --cpus is given
+// --cpus: the CPUs workers run on, each worker gets the next one in turn
+// --numa-bind: worker memory only comes from the NUMA node of its CPU
+// --incoming-cpu: a worker runs on the CPU that received the connection's
+// packets, or one on the same node, so it is near the NIC queue
+cpu_set_t workerCpus;
+int workerCpuCount = 0;
+int numaBind = 0;
+int steerIncoming = 0;
+// Next CPU to try when handing out CPUs in turn
+int nextWorkerCpu = 0;
+// NUMA node of each CPU, read from sysfs once at startup
+int cpuNodes[CPU_SETSIZE];
+
+// --capture writes one line of metadata per request for the replay tool
+// Only sizes, times and outcomes are kept, never any text or key contents
+// Times are in microseconds, start is measured from when the server started
+// wait_us is time spent waiting for message lengths, mostly the client's pause between
+// the handshake and its first message, receive_us only counts the message bodies
+// alphabet is the id from the handshake, see alphabets.def, since it changes the kernel's cost
+#define CAPTURE_HEADER "# start_us mode alphabet length key_length records handshake_us wait_us receive_us transform_us send_us total_us outcome\n"
+struct requestCapture {
+    long start;
+    const char* mode;
+    int alphabet;
+    int length;
+    int keyLength;
+    int records;
+    // Nanoseconds spent in each phase
+    long handshake;
+    long wait;
+    long receive;
+    long transform;
+    long send;
+    // The phase being timed and when it started, see captureBegin
+    long* phase;
+    long phaseStart;
+    // NULL until the request ends, a worker that exits without setting it failed
+    const char* outcome;
+};
+// Only one request per worker, so each child fills in its own copy
+struct requestCapture capture;
+int captureFD = -1;
+long serverStart;
+
+// set_mempolicy() is a plain system call, these are its values from numaif.h
+// so the server doesn't need libnuma
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+
+// Set by SIGUSR1 so the main loop prints the metrics
+volatile sig_atomic_t printCounters = 0;
+// Set by SIGTERM or SIGINT so the main loop flushes the spans and exits
+volatile sig_atomic_t stopServer = 0;
+
+// From server.c
+// Print formatted error message and exit with status code 
+void error(int exitCode, const char *message) {
+    fprintf(stderr, "Client error: %s\n", message);
+    exit(exitCode);
+}
+
+// From server.c 
+// Set up the address struct 
+void setupAddressStruct(struct sockaddr_in* address, int portNumber){
+    // Clear out the address struct 
+    memset((char*) address, '\0', sizeof(*address));
+    // The address should be network capable
+    address->sin_family = AF_INET;
+    // Store the port number
+    address->sin_port = htons(portNumber);
+    // Allow a client at any address to connect to this server 
+    address->sin_addr.s_addr = INADDR_ANY;
+}
+
+// Sets how long recv() and send() on the socket can block before failing with EAGAIN
+void setSocketTimeout(int connectionSocket, int seconds) {
+    struct timeval timeout = {seconds, 0};
+    setsockopt(connectionSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(connectionSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+// Monotonic time in nanoseconds for --capture
+long captureNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+// Starts timing a phase of the request into one of the capture's fields
+// The phase is kept open until captureEnd, so a worker that exits part way through,
+// like on a timeout, still records the time it spent in it
+void captureBegin(long* phase) {
+    capture.phase = phase;
+    capture.phaseStart = captureNow();
+}
+
+void captureEnd(void) {
+    if (capture.phase)
+        *capture.phase += captureNow() - capture.phaseStart;
+    capture.phase = NULL;
+}
+
+// Appends text and a space to a capture line, returns the end of the line
+char* appendText(char* line, const char* text) {
+    while (*text)
+        *line++ = *text++;
+    *line++ = ' ';
+    return line;
+}
+
+// Appends a number and a space to a capture line, returns the end of the line
+char* appendNumber(char* line, long number) {
+    char digits[24];
+    int count = 0;
+    if (number < 0) {
+        *line++ = '-';
+        number = -number;
+    }
+    do {
+        digits[count++] = '0' + number % 10;
+        number /= 10;
+    } while (number > 0);
+    while (count > 0)
+        *line++ = digits[--count];
+    *line++ = ' ';
+    return line;
+}
+
+// Formats the capture line into line, returns its length
+// Only async-signal-safe code so the request deadline's SIGALRM handler can use it
+int formatCapture(char* line) {
+    captureEnd();
+    char* end = line;
+    end = appendNumber(end, capture.start / 1000);
+    end = appendText(end, capture.mode ? capture.mode : "-");
+    end = appendNumber(end, capture.alphabet);
+    end = appendNumber(end, capture.length);
+    end = appendNumber(end, capture.keyLength);
+    end = appendNumber(end, capture.records);
+    end = appendNumber(end, capture.handshake / 1000);
+    end = appendNumber(end, capture.wait / 1000);
+    end = appendNumber(end, capture.receive / 1000);
+    end = appendNumber(end, capture.transform / 1000);
+    end = appendNumber(end, capture.send / 1000);
+    end = appendNumber(end, (captureNow() - serverStart) / 1000 - capture.start / 1000);
+    end = appendText(end, capture.outcome ? capture.outcome : "failed");
+    // The newline goes where the last space is
+    end[-1] = '\n';
+    return end - line;
+}
+
+// Writes the worker's capture line when it exits, however the request ended
+// The file is opened with O_APPEND and the line goes out in one write(), so
+// lines from workers finishing at the same time don't mix
+void writeCapture(void) {
+    char line[256];
+    int len = formatCapture(line);
+    if (write(captureFD, line, len) < 0)
+        perror("SERVER: capture");
+}
+
+// Ends the child if a socket call failed because its deadline passed
+void checkTimeout(int exitCode) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        capture.outcome = (exitCode == EXIT_HANDSHAKE_TIMEOUT) ? "handshake-timeout" : "idle-timeout";
+        exit(exitCode);
+    }
+}
+
+// Reads exactly size bytes, returns 0 if the client closed the connection first
+// A recv() that runs out of time ends the child with timeoutCode
+int receiveAll(int connectionSocket, void* buffer, int size, int timeoutCode) {
+    int totalRead = 0;
+    while (totalRead < size) {
+        int charsRead = recv(connectionSocket, (char*)buffer + totalRead, size - totalRead, 0);
+        if (charsRead < 0) {
+            checkTimeout(timeoutCode);
+            error(1, "SERVER: ERROR reading from socket");
+        }
+        if (charsRead == 0) {
+            return 0;
+        }
+        totalRead += charsRead;
+    }
+    return 1;
+}
+
+// SIGALRM handler for the whole-request deadline
+// Only async-signal-safe calls are allowed here, the socket is closed by _exit
+// _exit skips the atexit capture, so the line is written here
+void handleRequestTimeout(int signo) {
+    if (captureFD >= 0) {
+        char line[256];
+        capture.outcome = "request-timeout";
+        int len = formatCapture(line);
+        // A failed write can't be reported from a handler
+        ssize_t written = write(captureFD, line, len);
+        (void)written;
+    }
+    _exit(EXIT_REQUEST_TIMEOUT);
+}
+
+// SIGUSR1 handler, the metrics are printed from the main loop
+void handleCounterSignal(int signo) {
+    printCounters = 1;
+}
+
+// SIGTERM and SIGINT handler, the main loop stops so spans still in the ring are written
+void handleStopSignal(int signo) {
+    stopServer = 1;
+}
+
+// Code adapted from the code in Server Program section
+// https://canvas.oregonstate.edu/courses/1999732/pages/exploration-client-server-communication-via-sockets?module_item_id=25329397
+// Sends len bytes of data, which doesn't need to be null terminated
+void sendDataLength(int connectionSocket, const char* data, int len) {
+    TRACE_BEGIN(start);
+    captureBegin(&capture.send);
+    // Sends the length of the data  
+    int charsWritten = send(connectionSocket, &len, sizeof(len), 0);
+    // If negative, error occurred 
+    if (charsWritten < 0) {
+        checkTimeout(EXIT_IDLE_TIMEOUT);
+        error(1, "CLIENT: ERROR writing to socket");
+    }
+    // Track how many bytes already sent
+    int totalSent = 0;
+    // Loop until the total number of bytes sent is equal to the length 
+    while (totalSent < len) {
+        // Determine how many bytes to send
+        int bytesToSend;
+            if (len - totalSent < BUFFER_CAPACITY) {
+                bytesToSend = len - totalSent;
+            } else {
+                bytesToSend = BUFFER_CAPACITY;
+            }
+        // Send message through the socket
+        charsWritten = send(connectionSocket, data + totalSent, bytesToSend, 0);
+        if (charsWritten < 0) {
+            checkTimeout(EXIT_IDLE_TIMEOUT);
+            error(1, "CLIENT: WARNING: Not all data written to socket!");
+        }
+        // Updates how many bytes were successfully sent
+        totalSent += charsWritten;
+    }
+    captureEnd();
+    TRACE_END("sendData", start);
+}
+
+// Sends a null terminated string
+void sendData(int connectionSocket, char* data) {
+    // Calculate the number of characters 
+    sendDataLength(connectionSocket, data, (int)strlen(data));
+}
+
+// Sends an error reply instead of a result
+// A negative length tells the client this is an error code, the message follows as normal data
+void sendError(int connectionSocket, int errorCode, char* message) {
+    int code = -errorCode;
+    capture.outcome = "error";
+    if (send(connectionSocket, &code, sizeof(code), 0) < 0) {
+        checkTimeout(EXIT_IDLE_TIMEOUT);
+        error(1, "SERVER: ERROR writing to socket");
+    }
+    sendData(connectionSocket, message);
+}
+
+// Code adapted from the code in Server Program section
+// https://canvas.oregonstate.edu/courses/1999732/pages/exploration-client-server-communication-via-sockets?module_item_id=25329397
+// Reads the length at the start of a message
+// The length can arrive split across packets so it is read with receiveAll
+int receiveLength(int connectionSocket) {
+    captureBegin(&capture.wait);
+    int len;
+    if (!receiveAll(connectionSocket, &len, sizeof(len), EXIT_IDLE_TIMEOUT)) {
+        error(1, "SERVER: ERROR connection closed by client");
+    }
+    captureEnd();
+    return len;
+}
+
+// Reads the len bytes of a message after its length
+char* receiveBody(int connectionSocket, int len) {
+    TRACE_BEGIN(start);
+    captureBegin(&capture.receive);
+    int charsRead;
+    // A negative length would make malloc and the loop below misbehave
+    if (len < 0) {
+        error(1, "SERVER: ERROR invalid message length");
+    }
+    // Allocate memory for the message (+1 for null terminator)
+    char* result = malloc(len + 1);
+    if (!result) {
+        error(1, "CLIENT: ERROR allocating memory");
+    }
+    // Track how many bytes have been read
+    int totalRead = 0;
+    // Loop until all expected bytes are received
+    while (totalRead < len) {
+        int bytesToRead;
+        if (len - totalRead < BUFFER_CAPACITY) {
+            bytesToRead = len - totalRead;
+        } else {
+            bytesToRead = BUFFER_CAPACITY;
+        }
+        charsRead = recv(connectionSocket, result + totalRead, bytesToRead, 0);
+        if (charsRead < 0) {
+            checkTimeout(EXIT_IDLE_TIMEOUT);
+            error(1, "CLIENT: ERROR reading from socket");
+        }
+        // 0 means the client closed the connection, without this the loop never ends
+        if (charsRead == 0) {
+            error(1, "SERVER: ERROR connection closed by client");
+        }
+        // Updates how many bytes were successfully read
+        totalRead += charsRead;
+    }
+    result[len] = '\0'; 
+    captureEnd();
+    TRACE_END("receiveData", start);
+    return result;
+}
+
+// The number of bytes received is stored in length so callers don't need strlen()
+char* receiveData(int connectionSocket, int* length) {
+    // Receive the length of the incoming message
+    int len = receiveLength(connectionSocket);
+    *length = len;
+    return receiveBody(connectionSocket, len);
+}
+
+// Adapted code for the validation logic 
+// https://github.com/CS-344-nilsstreedain/program4/blob/main/enc_server.c
+// Verify the client and find out which direction it wants
+// Returns MODE_ENC for enc_client, MODE_DEC for dec_client and MODE_XOR for either with --binary
+// The last byte of the handshake is the alphabet, see alphabet.h, which is stored in alphabet
+int verifyClient(int connectionSocket, int* alphabet) {
+    char client[4], server[4] = "rej";
+    int mode = 0;
+    memset(client, '\0', sizeof(client));
+    // The client only gets handshakeTimeout seconds to identify itself
+    setSocketTimeout(connectionSocket, handshakeTimeout);
+    // Receives a message of 4 bytes from the client through the socket
+    captureBegin(&capture.handshake);
+    int received = receiveAll(connectionSocket, client, sizeof(client), EXIT_HANDSHAKE_TIMEOUT);
+    captureEnd();
+    if (!received) {
+        capture.outcome = "closed";
+        error(1, "SERVER: ERROR connection closed during handshake");
+    }
+    // Compares the received client string to the directions this server accepts
+    *alphabet = (unsigned char)client[3];
+    int knownAlphabet = (*alphabet < ALPHABET_COUNT);
+    if (knownAlphabet && (SERVER_MODES & MODE_ENC) && strncmp(client, "enc", 3) == 0) {
+        mode = MODE_ENC;
+        strcpy(server, "enc");
+    } else if (knownAlphabet && (SERVER_MODES & MODE_DEC) && strncmp(client, "dec", 3) == 0) {
+        mode = MODE_DEC;
+        strcpy(server, "dec");
+    } else if ((SERVER_MODES & MODE_XOR) && memcmp(client, "xor", sizeof(client)) == 0) {
+        // Byte mode has no alphabet, the last byte is always 0
+        mode = MODE_XOR;
+        strcpy(server, "xor");
+    } else if ((SERVER_MODES & (MODE_ENC | MODE_DEC)) == MODE_DEC) {
+        // A single direction server answers with its own name like before
+        strcpy(server, "dec");
+    } else if ((SERVER_MODES & (MODE_ENC | MODE_DEC)) == MODE_ENC) {
+        strcpy(server, "enc");
+    }
+    // The reply repeats the alphabet so the client knows it was accepted
+    if (mode != 0)
+        server[3] = *alphabet;
+    // Sends back to client 
+    // Handshake message to verify client, the client checks it matches what it sent
+    int charsWritten = send(connectionSocket, server, sizeof(server), 0);
+    if (charsWritten < 0) {
+        error(1, "CLIENT: ERROR writing to socket");
+    }
+    if (mode == 0) {
+        // If strings do not match, close socket
+        __sync_fetch_and_add(&metrics->rejectedClients, 1);
+        capture.outcome = "rejected";
+        close(connectionSocket);
+        error(2, "CLIENT: Rejected connection: Client not validated");
+    }
+    // The rest of the request uses the idle deadline
+    setSocketTimeout(connectionSocket, idleTimeout);
+    return mode;
+}
+
+// Transforms len characters of text with the key into result with the kernel
+// alphabet.h generates for the alphabet
+// MODE_ENC adds the key to plaintext, MODE_DEC subtracts it from ciphertext
+// Returns nonzero if any character of the text or key is not in the alphabet
+unsigned char otpKernel(const char* text, const char* key, char* result, int len, int mode, int alphabet) {
+    return alphabetKernel(alphabet, text, key, result, len, mode == MODE_DEC);
+}
+
+// A batch request carries many (text, key) records in one frame
+// Sent as BATCH_REQUEST in place of the first length, then three messages:
+// 1. the offsets table, count + 1 ints where record i is offsets[i] to offsets[i + 1]
+// 2. every text record back to back
+// 3. every key record back to back, each cut to the length of its text record
+// The reply is BATCH_REQUEST, the same offsets table, and every result back to back
+// Since the keys line up with the texts the whole batch is one pass of otpKernel
+void otpBatchTransform(int connectionSocket, int mode, int alphabet) {
+    const char* textName = (mode == MODE_ENC) ? "plaintext" : "ciphertext";
+    char message[80];
+    int tableLen, len, keyLen;
+    int* offsets = (int*) receiveData(connectionSocket, &tableLen);
+    char* text = receiveData(connectionSocket, &len);
+    char* key = receiveData(connectionSocket, &keyLen);
+    int count = tableLen / (int)sizeof(int) - 1;
+    capture.length = len;
+    capture.keyLength = keyLen;
+    capture.records = count;
+    // Checks the table covers the text exactly and the keys line up with it
+    int valid = (count >= 0) && (tableLen % sizeof(int) == 0) && (keyLen == len)
+                && (offsets[0] == 0) && (offsets[count] == len);
+    for (int i = 0; valid && i < count; i++) {
+        valid = (offsets[i] <= offsets[i + 1]);
+    }
+    __sync_fetch_and_add(&metrics->batchRequests, 1);
+    if (!valid) {
+        __sync_fetch_and_add(&metrics->errorReplies, 1);
+        sendError(connectionSocket, REPLY_INVALID_BATCH, "Invalid batch offsets");
+    } else {
+        __sync_fetch_and_add(&metrics->batchRecords, count);
+        char* result = (char*) malloc(len + 1);
+        if (!result) {
+            error(1, "SERVER: ERROR allocating memory");
+        }
+        TRACE_BEGIN(transformStart);
+        captureBegin(&capture.transform);
+        unsigned char invalid = otpKernel(text, key, result, len, mode, alphabet);
+        captureEnd();
+        TRACE_END("transform", transformStart);
+        if (invalid) {
+            // Only a rejected batch pays for going through the records one at a time
+            // to find which one to report
+            int record = 0;
+            while (record < count && !otpKernel(text + offsets[record], key + offsets[record],
+                                                result + offsets[record],
+                                                offsets[record + 1] - offsets[record], mode, alphabet)) {
+                record++;
+            }
+            __sync_fetch_and_add(&metrics->errorReplies, 1);
+            snprintf(message, sizeof(message), "Invalid character in %s or key of record %d", textName, record);
+            sendError(connectionSocket, REPLY_INVALID_CHARACTER, message);
+        } else {
+            int header = BATCH_REQUEST;
+            if (send(connectionSocket, &header, sizeof(header), 0) < 0) {
+                checkTimeout(EXIT_IDLE_TIMEOUT);
+                error(1, "SERVER: ERROR writing to socket");
+            }
+            sendDataLength(connectionSocket, (char*)offsets, tableLen);
+            sendDataLength(connectionSocket, result, len);
+        }
+        free(result);
+    }
+    free(offsets);
+    free(text);
+    free(key);
+    close(connectionSocket);
+}
+
+// After verifying the connection this child receives the text and a key via the connected socket
+// or a batch of them, see otpBatchTransform
+void otpTransform(int connectionSocket, int mode, int alphabet) {
+    const char* textName = (mode == MODE_ENC) ? "plaintext" : "ciphertext";
+    char message[64];
+    int len = receiveLength(connectionSocket);
+    // A batch is counted in batchRequests only
+    if (len == BATCH_REQUEST) {
+        otpBatchTransform(connectionSocket, mode, alphabet);
+        return;
+    }
+    if (mode == MODE_ENC) {
+        __sync_fetch_and_add(&metrics->encryptRequests, 1);
+    } else {
+        __sync_fetch_and_add(&metrics->decryptRequests, 1);
+    }
+    // Read the text message from the client
+    int keyLen;
+    char* text = receiveBody(connectionSocket, len);
+    char* key = receiveData(connectionSocket, &keyLen);
+    capture.length = len;
+    capture.keyLength = keyLen;
+    // Key pased in must be at least as big as the text  
+    if (keyLen < len) {
+        __sync_fetch_and_add(&metrics->errorReplies, 1);
+        snprintf(message, sizeof(message), "Key is shorter than %s", textName);
+        sendError(connectionSocket, REPLY_KEY_TOO_SHORT, message);
+        free(text);
+        free(key);
+        close(connectionSocket);
+        return;
+    }
+    char* result = (char*) malloc(len + 1);
+    if (!result) {
+        error(1, "SERVER: ERROR allocating memory");
+    }
+    TRACE_BEGIN(transformStart);
+    captureBegin(&capture.transform);
+    unsigned char invalid = otpKernel(text, key, result, len, mode, alphabet);
+    captureEnd();
+    TRACE_END("transform", transformStart);
+    // Adds a null terminator to the end of the result string
+    result[len] = '\0';
+    if (invalid) {
+        __sync_fetch_and_add(&metrics->errorReplies, 1);
+        snprintf(message, sizeof(message), "Invalid character in %s or key", textName);
+        sendError(connectionSocket, REPLY_INVALID_CHARACTER, message);
+    } else {
+        // Sends the result back to the client
+        sendData(connectionSocket, result);
+    }
+    free(result);
+    free(text);
+    free(key);
+    close(connectionSocket);
+}
+
+// XORs every byte of the data with the key
+// Kept apart from otpTransform so the loop is a plain XOR the compiler turns
+// into the widest vector instructions available. On x86-64 an AVX2 copy is
+// built too and picked at startup if the CPU has it
+#if defined(__x86_64__)
+__attribute__((target_clones("avx2", "default")))
+#endif
+void xorKernel(const unsigned char* restrict data, const unsigned char* restrict key,
+               unsigned char* restrict result, int len) {
+    for (int i = 0; i < len; i++) {
+        result[i] = data[i] ^ key[i];
+    }
+}
+
+// Byte mode for binary payloads, every value from 0 to 255 is allowed so
+// there is nothing to validate and no newline handling
+void xorTransform(int connectionSocket) {
+    __sync_fetch_and_add(&metrics->xorRequests, 1);
+    int len, keyLen;
+    char* data = receiveData(connectionSocket, &len);
+    char* key = receiveData(connectionSocket, &keyLen);
+    capture.length = len;
+    capture.keyLength = keyLen;
+    if (keyLen < len) {
+        __sync_fetch_and_add(&metrics->errorReplies, 1);
+        sendError(connectionSocket, REPLY_KEY_TOO_SHORT, "Key is shorter than data");
+    } else {
+        char* result = (char*) malloc(len + 1);
+        if (!result) {
+            error(1, "SERVER: ERROR allocating memory");
+        }
+        TRACE_BEGIN(transformStart);
+        captureBegin(&capture.transform);
+        xorKernel((unsigned char*)data, (unsigned char*)key, (unsigned char*)result, len);
+        captureEnd();
+        TRACE_END("transform", transformStart);
+        // The result can contain null bytes so the length is passed along
+        sendDataLength(connectionSocket, result, len);
+        free(result);
+    }
+    free(data);
+    free(key);
+    close(connectionSocket);
+}
+
+// Adds a reaped child to the deadline counters if it ran out of time
+void countTimeout(int status) {
+    if (!WIFEXITED(status)) {
+        return;
+    }
+    switch (WEXITSTATUS(status)) {
+        case EXIT_HANDSHAKE_TIMEOUT:
+            __sync_fetch_and_add(&metrics->handshakeTimeouts, 1);
+            break;
+        case EXIT_IDLE_TIMEOUT:
+            __sync_fetch_and_add(&metrics->idleTimeouts, 1);
+            break;
+        case EXIT_REQUEST_TIMEOUT:
+            __sync_fetch_and_add(&metrics->requestTimeouts, 1);
+            break;
+    }
+}
+
+// Reads a CPU list like "0-3,8" into cpus
+// Returns the number of CPUs in the list, or 0 if it can't be read
+int parseCpuList(const char* list, cpu_set_t* cpus) {
+    CPU_ZERO(cpus);
+    const char* p = list;
+    while (*p) {
+        char* end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+        if (end == p)
+            return 0;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p)
+                return 0;
+        }
+        if (first < 0 || last >= CPU_SETSIZE || first > last)
+            return 0;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, cpus);
+        p = end;
+        if (*p == ',')
+            p++;
+        else if (*p)
+            return 0;
+    }
+    return CPU_COUNT(cpus);
+}
+
+// Fills cpuNodes from /sys/devices/system/cpu/cpuN/nodeM
+// A CPU without a node entry, or a kernel without NUMA, is node 0
+void readCpuNodes(void) {
+    char path[64];
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        cpuNodes[cpu] = 0;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+        DIR* dir = opendir(path);
+        if (!dir)
+            continue;
+        struct dirent* entry;
+        while ((entry = readdir(dir)) != NULL) {
+            if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+                cpuNodes[cpu] = atoi(entry->d_name + 4);
+                break;
+            }
+        }
+        closedir(dir);
+    }
+}
+
+// Picks the CPU the worker for this connection runs on
+// Returns -1 when workers aren't pinned
+int pickWorkerCpu(int connectionSocket) {
+    if (workerCpuCount == 0)
+        return -1;
+    int wantedNode = -1;
+#ifdef SO_INCOMING_CPU
+    if (steerIncoming) {
+        int incomingCpu = -1;
+        socklen_t size = sizeof(incomingCpu);
+        if (getsockopt(connectionSocket, SOL_SOCKET, SO_INCOMING_CPU, &incomingCpu, &size) == 0
+            && incomingCpu >= 0 && incomingCpu < CPU_SETSIZE) {
+            if (CPU_ISSET(incomingCpu, &workerCpus))
+                return incomingCpu;
+            // Not one of the worker CPUs, so take one on the same node
+            wantedNode = cpuNodes[incomingCpu];
+        }
+    }
+#endif
+    // Goes round the worker CPUs starting after the last one handed out
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < CPU_SETSIZE; i++) {
+            int cpu = (nextWorkerCpu + i) % CPU_SETSIZE;
+            if (!CPU_ISSET(cpu, &workerCpus))
+                continue;
+            // First pass only looks at the wanted node
+            if (pass == 0 && wantedNode >= 0 && cpuNodes[cpu] != wantedNode)
+                continue;
+            nextWorkerCpu = cpu + 1;
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+// Moves the calling worker onto cpu and optionally keeps its memory on that CPU's node
+// Called in the child before it allocates any buffers, so they are placed on the local node
+void placeWorker(int cpu) {
+    if (cpu < 0)
+        return;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) < 0)
+        perror("SERVER: sched_setaffinity");
+    if (numaBind) {
+        int node = cpuNodes[cpu];
+        unsigned long nodeMask[4] = {0};
+        if (node < (int)(sizeof(nodeMask) * 8)) {
+            nodeMask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+            if (syscall(SYS_set_mempolicy, MPOL_BIND, nodeMask, sizeof(nodeMask) * 8) < 0)
+                perror("SERVER: set_mempolicy");
+        }
+    }
+}
+
+// https://canvas.oregonstate.edu/courses/1999732/pages/exploration-client-server-communication-via-sockets?module_item_id=25329397 
+int main(int argc, const char * argv[]) {
+    // Deadlines can be changed from the defaults, 0 turns one off
+    static struct option options[] = {
+        {"handshake-timeout", required_argument, 0, 'h'},
+        {"idle-timeout", required_argument, 0, 'i'},
+        {"request-timeout", required_argument, 0, 'r'},
+        {"cpus", required_argument, 0, 'c'},
+        {"numa-bind", no_argument, 0, 'n'},
+        {"incoming-cpu", no_argument, 0, 'p'},
+        {"capture", required_argument, 0, 'w'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, (char* const*)argv, "h:i:r:c:npw:", options, NULL)) != -1) {
+        switch (opt) {
+            case 'h':
+                handshakeTimeout = atoi(optarg);
+                break;
+            case 'i':
+                idleTimeout = atoi(optarg);
+                break;
+            case 'r':
+                requestTimeout = atoi(optarg);
+                break;
+            case 'c':
+                workerCpuCount = parseCpuList(optarg, &workerCpus);
+                if (workerCpuCount == 0)
+                    error(1, "--cpus must be a list like 0-3,8");
+                break;
+            case 'n':
+                numaBind = 1;
+                break;
+            case 'p':
+                steerIncoming = 1;
+                break;
+            case 'w':
+                captureFD = open(optarg, O_WRONLY | O_CREAT | O_APPEND, 0644);
+                if (captureFD < 0)
+                    error(1, "Cannot open capture file");
+                // A new file starts with a header naming the columns
+                if (lseek(captureFD, 0, SEEK_END) == 0 && write(captureFD, CAPTURE_HEADER, strlen(CAPTURE_HEADER)) < 0)
+                    error(1, "Cannot write capture file");
+                break;
+            default:
+                fprintf(stderr, "USAGE: %s [--handshake-timeout sec] [--idle-timeout sec] [--request-timeout sec]\n"
+                        "       [--cpus list [--numa-bind] [--incoming-cpu]] [--capture file] port\n", argv[0]);
+                exit(1);
+        }
+    }
+    // Checks if the user provided a port number 
+    if (argc - optind < 1) {
+        fprintf(stderr, "USAGE: %s [--handshake-timeout sec] [--idle-timeout sec] [--request-timeout sec]\n"
+                "       [--cpus list [--numa-bind] [--incoming-cpu]] [--capture file] port\n", argv[0]);
+        exit(1);
+    }
+    if ((numaBind || steerIncoming) && workerCpuCount == 0)
+        error(1, "--numa-bind and --incoming-cpu need --cpus");
+    if (workerCpuCount > 0)
+        readCpuNodes();
+    serverStart = captureNow();
+    // Set up before any fork so the children record into the same ring
+    traceInit();
+    // Shared with every child so all connections count into the same metrics
+    metrics = mmap(NULL, sizeof(*metrics), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (metrics == MAP_FAILED)
+        error(1, "ERROR allocating metrics");
+    memset(metrics, 0, sizeof(*metrics));
+    // SIGUSR1 prints the metrics
+    // No SA_RESTART so a blocked accept() returns and the main loop can print them
+    struct sigaction counterAction = {0};
+    counterAction.sa_handler = handleCounterSignal;
+    sigemptyset(&counterAction.sa_mask);
+    sigaction(SIGUSR1, &counterAction, NULL);
+    // SIGTERM and SIGINT stop the server the same way, from the main loop
+    struct sigaction stopAction = {0};
+    stopAction.sa_handler = handleStopSignal;
+    sigemptyset(&stopAction.sa_mask);
+    sigaction(SIGTERM, &stopAction, NULL);
+    sigaction(SIGINT, &stopAction, NULL);
+    // From server.c
+    // Create the socket that will listen for connections
+    int listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+    if (listenSocket < 0)
+        error(1, "ERROR opening socket");
+    struct sockaddr_in serverAddress, clientAddress;
+    socklen_t sizeOfClientInfo = sizeof(clientAddress);
+    // Set up the address struct for the server socket
+    setupAddressStruct(&serverAddress, atoi(argv[optind]));
+    // Associate the socket to the port
+    if (bind(listenSocket, 
+         (struct sockaddr *)&serverAddress, 
+         sizeof(serverAddress)) < 0){
+    error(1, "ERROR on binding");
+}   
+    // From server.c
+    // Start listening for connections
+    listen(listenSocket, 5);
+    // Tracks the number of active child processes 
+    int childCount = 0;
+    while (1) {
+        // https://canvas.oregonstate.edu/courses/1999732/pages/exploration-process-api-monitoring-child-processes?module_item_id=25329381
+        // Checks for any child process that has exited
+        // WNOHANG specified. If the child hasn't termianted,
+        // waitpid will immediately return the value 0
+        // When every worker is busy, block until one finishes instead of spinning
+        int status;
+        int waitOptions = (childCount < MAX_CHILDREN) ? WNOHANG : 0;
+        while (waitpid(-1, &status, waitOptions) > 0) {
+            childCount = childCount -1;
+            countTimeout(status);
+            waitOptions = WNOHANG;
+        }
+        // Spans recorded by the children are written here, off the request path
+        traceFlush();
+        if (stopServer)
+            break;
+        // Print the metrics if SIGUSR1 asked for them
+        if (printCounters) {
+            printCounters = 0;
+            fprintf(stderr, "%s: encrypt requests %ld, decrypt requests %ld, xor requests %ld, batch requests %ld, batch records %ld, rejected clients %ld, error replies %ld, "
+                    "handshake timeouts %ld, idle timeouts %ld, request timeouts %ld\n",
+                    argv[0], metrics->encryptRequests, metrics->decryptRequests, metrics->xorRequests,
+                    metrics->batchRequests, metrics->batchRecords,
+                    metrics->rejectedClients, metrics->errorReplies, metrics->handshakeTimeouts,
+                    metrics->idleTimeouts, metrics->requestTimeouts);
+        }
+
+        // Accept new copnnections if the current number of child processes is less than 5
+        if (childCount < MAX_CHILDREN) {
+            // Waits for a connection at most FLUSH_INTERVAL_MS, then goes back around to flush
+            struct pollfd listenPoll = {listenSocket, POLLIN, 0};
+            if (poll(&listenPoll, 1, FLUSH_INTERVAL_MS) <= 0)
+                continue;
+            int connectionSocket = accept(listenSocket, 
+                (struct sockaddr *)&clientAddress, 
+                &sizeOfClientInfo);
+            if (connectionSocket < 0) {
+                // Interrupted by a signal, go back around to print the counters or stop
+                if (errno == EINTR) {
+                    continue;
+                }
+                error(1, "ERROR on accept");
+            }
+            // Adapted from example code
+            // https://canvas.oregonstate.edu/courses/1999732/pages/exploration-process-api-monitoring-child-processes?module_item_id=25329381
+            // Fork a child process
+            // Each connection is picked for tracing or not before the fork, the child keeps the choice
+            traceSample();
+            capture.start = captureNow() - serverStart;
+            int workerCpu = pickWorkerCpu(connectionSocket);
+            TRACE_BEGIN(forkStart);
+            int spawnpid = fork();
+            switch (spawnpid) {
+                case -1:
+                    error(1, "Fork failed");
+                    break;
+                case 0:
+                    // Child process
+                    // Only the parent stops from the main loop, workers end on SIGTERM as before
+                    signal(SIGTERM, SIG_DFL);
+                    signal(SIGINT, SIG_DFL);
+                    // The handler has no SA_RESTART, so SIGUSR1 would break a worker's recv()
+                    // with EINTR, pkill -USR1 reaches every worker and only the parent prints
+                    signal(SIGUSR1, SIG_IGN);
+                    // The whole request has to finish before requestTimeout
+                    signal(SIGALRM, handleRequestTimeout);
+                    alarm(requestTimeout);
+                    placeWorker(workerCpu);
+                    if (captureFD >= 0)
+                        atexit(writeCapture);
+                    TRACE_BEGIN(requestStart);
+                    TRACE_BEGIN(verifyStart);
+                    int alphabet;
+                    int mode = verifyClient(connectionSocket, &alphabet);
+                    capture.mode = (mode == MODE_ENC) ? "enc" : (mode == MODE_DEC) ? "dec" : "xor";
+                    capture.alphabet = alphabet;
+                    TRACE_END("verifyClient", verifyStart);
+                    if (mode == MODE_XOR) {
+                        xorTransform(connectionSocket);
+                    } else {
+                        otpTransform(connectionSocket, mode, alphabet);
+                    }
+                    TRACE_END("request", requestStart);
+                    if (!capture.outcome)
+                        capture.outcome = "ok";
+                    exit(0);
+                default:
+                    // Parent process
+                    TRACE_END("fork", forkStart);
+                    childCount = childCount + 1;
+                    close(connectionSocket);
+            }
+        }
+    }
+
+    close(listenSocket);
+    return 0;
+}
@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <netdb.h>
+#include "alphabet.h"
+
+/**
+* Replays a capture written by otp_server --capture against a local server
+* 1. Read every request from the capture, sizes and times only.
+* 2. Sort them by arrival, workers write their lines as they finish so the file is in
+*    completion order, then start each request at the same offset from the first arrival
+*    as it had, in its own child.
+* 3. Each child waits as long as the captured client did before its handshake and again
+*    before its first message, then sends made up text and key of the captured sizes in
+*    the captured alphabet (random bytes for xor).
+*    Clients that stalled until a server deadline ended them stall the same way, sending
+*    nothing more until the server closes the connection, so they hold a worker like they did.
+* 4. Print how each request ended and the latency percentiles, to compare server builds.
+*/
+
+#define BUFFER_CAPACITY 1000
+// Sent in place of a message length to start a batch request, same as otp_server.c
+#define BATCH_REQUEST -1000
+
+// How a replayed request ended
+#define REPLAY_FAILED 0
+#define REPLAY_OK 1
+// Stalled like the captured client and the server ended it with a deadline
+#define REPLAY_STALLED 2
+// Closed before the handshake like the captured client
+#define REPLAY_CLOSED 3
+// Sent a handshake the server doesn't accept like the captured client
+#define REPLAY_REJECTED 4
+
+// Print formatted error message and exit with status code
+void error(int exitCode, const char *message) {
+    fprintf(stderr, "replay error: %s\n", message);
+    exit(exitCode);
+}
+
+// One line of the capture
+struct capturedRequest {
+    long start;
+    char mode[8];
+    int alphabet;
+    int length;
+    int keyLength;
+    int records;
+    long handshake;
+    long wait;
+    char outcome[24];
+};
+
+// What a child found when it replayed its request
+// Kept in shared memory so the parent can read every child's result
+struct replayResult {
+    long latency;
+    int done;
+    int kind;
+};
+
+// Monotonic time in microseconds
+long nowMicros(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000L + now.tv_nsec / 1000;
+}
+
+// Sleeps for a number of microseconds, nanosleep() is restarted if a signal interrupts it
+void sleepMicros(long micros) {
+    if (micros <= 0)
+        return;
+    struct timespec wait = {micros / 1000000, (micros % 1000000) * 1000};
+    while (nanosleep(&wait, &wait) < 0)
+        ;
+}
+
+// Sends a length then len bytes of data, returns 0 if the server went away
+int sendMessage(int socketFD, const char* data, int len) {
+    if (send(socketFD, &len, sizeof(len), MSG_NOSIGNAL) != sizeof(len))
+        return 0;
+    int totalSent = 0;
+    while (totalSent < len) {
+        int bytesToSend = (len - totalSent < BUFFER_CAPACITY) ? len - totalSent : BUFFER_CAPACITY;
+        int charsWritten = send(socketFD, data + totalSent, bytesToSend, MSG_NOSIGNAL);
+        if (charsWritten <= 0)
+            return 0;
+        totalSent += charsWritten;
+    }
+    return 1;
+}
+
+// Reads and throws away len bytes, returns 0 if the server went away
+int skipBytes(int socketFD, int len) {
+    char buffer[BUFFER_CAPACITY];
+    while (len > 0) {
+        int charsRead = recv(socketFD, buffer, (len < BUFFER_CAPACITY) ? len : BUFFER_CAPACITY, 0);
+        if (charsRead <= 0)
+            return 0;
+        len -= charsRead;
+    }
+    return 1;
+}
+
+// Reads the length at the start of a message
+int receiveLength(int socketFD, int* len) {
+    return recv(socketFD, len, sizeof(*len), MSG_WAITALL) == sizeof(*len);
+}
+
+// Sends nothing more and waits for the server to close the connection
+// Returns REPLAY_STALLED if it did, a reply means the server didn't treat it as stalled
+int stallUntilClosed(int socketFD) {
+    char buffer[BUFFER_CAPACITY];
+    int charsRead = recv(socketFD, buffer, sizeof(buffer), 0);
+    close(socketFD);
+    return (charsRead <= 0) ? REPLAY_STALLED : REPLAY_FAILED;
+}
+
+// Runs one captured request, returns how it ended, REPLAY_OK if the server sent back a result
+int replayRequest(const struct capturedRequest* request, int port, double speed,
+                  const char* text, const char* key) {
+    int socketFD = socket(AF_INET, SOCK_STREAM, 0);
+    if (socketFD < 0)
+        return REPLAY_FAILED;
+    struct sockaddr_in serverAddress;
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_port = htons(port);
+    struct hostent* hostInfo = gethostbyname("localhost");
+    if (hostInfo == NULL)
+        return REPLAY_FAILED;
+    memcpy(&serverAddress.sin_addr.s_addr, hostInfo->h_addr_list[0], hostInfo->h_length);
+    if (connect(socketFD, (struct sockaddr*)&serverAddress, sizeof(serverAddress)) < 0)
+        return REPLAY_FAILED;
+    // The captured client never sent its handshake
+    if (strcmp(request->outcome, "handshake-timeout") == 0)
+        return stallUntilClosed(socketFD);
+    // Behaves like the captured client before its handshake
+    sleepMicros(request->handshake / speed);
+    if (strcmp(request->outcome, "closed") == 0) {
+        close(socketFD);
+        return REPLAY_CLOSED;
+    }
+    // Sends an identifier no server accepts, the server answers and closes the connection
+    if (strcmp(request->outcome, "rejected") == 0) {
+        char response[4];
+        if (send(socketFD, "bad", 4, MSG_NOSIGNAL) != 4
+            || recv(socketFD, response, sizeof(response), MSG_WAITALL) != sizeof(response)) {
+            close(socketFD);
+            return REPLAY_FAILED;
+        }
+        return (stallUntilClosed(socketFD) == REPLAY_STALLED) ? REPLAY_REJECTED : REPLAY_FAILED;
+    }
+    char id[4] = {0};
+    memcpy(id, request->mode, 3);
+    id[3] = request->alphabet;
+    char response[4] = {0};
+    if (send(socketFD, id, sizeof(id), MSG_NOSIGNAL) != sizeof(id)
+        || recv(socketFD, response, sizeof(response), MSG_WAITALL) != sizeof(response)
+        || strncmp(id, response, sizeof(id)) != 0) {
+        close(socketFD);
+        return REPLAY_FAILED;
+    }
+    // The captured client stopped after the handshake until a deadline ended it
+    if (strcmp(request->outcome, "idle-timeout") == 0 || strcmp(request->outcome, "request-timeout") == 0)
+        return stallUntilClosed(socketFD);
+    // Pauses as long as the captured client did before sending its messages
+    sleepMicros(request->wait / speed);
+    int ok;
+    if (request->records > 0) {
+        // Splits the captured length evenly between the records
+        int count = request->records;
+        int* offsets = malloc((count + 1) * sizeof(int));
+        for (int i = 0; i <= count; i++)
+            offsets[i] = (int)((long)request->length * i / count);
+        int header = BATCH_REQUEST;
+        ok = send(socketFD, &header, sizeof(header), MSG_NOSIGNAL) == sizeof(header)
+             && sendMessage(socketFD, (char*)offsets, (count + 1) * sizeof(int))
+             && sendMessage(socketFD, text, request->length)
+             && sendMessage(socketFD, key, request->length);
+        free(offsets);
+    } else {
+        ok = sendMessage(socketFD, text, request->length)
+             && sendMessage(socketFD, key, request->keyLength);
+    }
+    // Reads the reply, a negative length is an error code followed by a message
+    int len;
+    ok = ok && receiveLength(socketFD, &len);
+    if (ok && len == BATCH_REQUEST) {
+        ok = receiveLength(socketFD, &len) && skipBytes(socketFD, len)
+             && receiveLength(socketFD, &len) && skipBytes(socketFD, len);
+    } else if (ok && len < 0) {
+        ok = 0;
+    } else if (ok) {
+        ok = skipBytes(socketFD, len);
+    }
+    close(socketFD);
+    return ok ? REPLAY_OK : REPLAY_FAILED;
+}
+
+// Fills a buffer with made up data, characters of the alphabet or any byte for xor
+char* syntheticData(int len, int binary, int alphabet) {
+    int charsetSize = alphabetSize(alphabet);
+    char* data = malloc(len + 1);
+    if (!data)
+        error(1, "Memory allocation failed");
+    for (int i = 0; i < len; i++)
+        data[i] = binary ? (char)(rand() & 0xff) : alphabetSymbol(alphabet, rand() % charsetSize);
+    data[len] = '\0';
+    return data;
+}
+
+// For qsort()
+int compareLong(const void* a, const void* b) {
+    long x = *(const long*)a, y = *(const long*)b;
+    return (x > y) - (x < y);
+}
+
+// For qsort(), orders requests by when they arrived
+int compareStart(const void* a, const void* b) {
+    return compareLong(&((const struct capturedRequest*)a)->start, &((const struct capturedRequest*)b)->start);
+}
+
+int main(int argc, char* argv[]) {
+    // --speed plays the capture faster (2) or slower (0.5) than it was recorded
+    double speed = 1.0;
+    static struct option options[] = {
+        {"speed", required_argument, 0, 's'},
+        {0, 0, 0, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "s:", options, NULL)) != -1) {
+        switch (opt) {
+            case 's':
+                speed = atof(optarg);
+                if (speed <= 0)
+                    error(1, "--speed must be more than 0");
+                break;
+            default:
+                error(1, "Usage: ./replay [--speed factor] <capture> <portNumber>");
+        }
+    }
+    if (argc - optind != 2)
+        error(1, "Usage: ./replay [--speed factor] <capture> <portNumber>");
+    FILE* f = fopen(argv[optind], "r");
+    if (!f)
+        error(1, "Cannot open capture file");
+    int port = atoi(argv[optind + 1]);
+
+    // Reads every request, lines starting with # are comments
+    // Lines without the wait_us and alphabet columns are from an older server and are skipped
+    int count = 0, capacity = 1024;
+    struct capturedRequest* requests = malloc(capacity * sizeof(*requests));
+    int maxLength = 0;
+    char line[512];
+    while (fgets(line, sizeof(line), f)) {
+        if (line[0] == '#')
+            continue;
+        if (count == capacity) {
+            capacity *= 2;
+            requests = realloc(requests, capacity * sizeof(*requests));
+        }
+        if (!requests)
+            error(1, "Memory allocation failed");
+        struct capturedRequest* request = &requests[count];
+        long receive, transform, send, total;
+        if (sscanf(line, "%ld %7s %d %d %d %d %ld %ld %ld %ld %ld %ld %23s", &request->start, request->mode,
+                   &request->alphabet, &request->length, &request->keyLength, &request->records, &request->handshake,
+                   &request->wait, &receive, &transform, &send, &total, request->outcome) != 13
+            || request->alphabet < 0 || request->alphabet >= ALPHABET_COUNT)
+            continue;
+        if (request->length > maxLength)
+            maxLength = request->length;
+        if (request->keyLength > maxLength)
+            maxLength = request->keyLength;
+        count++;
+    }
+    fclose(f);
+    if (count == 0)
+        error(1, "No requests in capture file");
+
+    // Data is made up once before starting so children only send it
+    char* texts[ALPHABET_COUNT];
+    char* keys[ALPHABET_COUNT];
+    for (int i = 0; i < ALPHABET_COUNT; i++) {
+        texts[i] = syntheticData(maxLength, 0, i);
+        keys[i] = syntheticData(maxLength, 0, i);
+    }
+    char* binaryText = syntheticData(maxLength, 1, 0);
+    char* binaryKey = syntheticData(maxLength, 1, 0);
+    struct replayResult* results = mmap(NULL, count * sizeof(*results), PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (results == MAP_FAILED)
+        error(1, "Cannot allocate results");
+
+    // Lines are written when each request finishes, so they are put back in arrival order
+    qsort(requests, count, sizeof(*requests), compareStart);
+    long replayStart = nowMicros();
+    long firstStart = requests[0].start;
+    for (int i = 0; i < count; i++) {
+        // Waits until this request's offset from the first arrival
+        sleepMicros(replayStart + (long)((requests[i].start - firstStart) / speed) - nowMicros());
+        // Reaps children that have finished so they don't pile up
+        while (waitpid(-1, NULL, WNOHANG) > 0)
+            ;
+        pid_t spawnpid = fork();
+        if (spawnpid < 0)
+            error(1, "Fork failed");
+        if (spawnpid == 0) {
+            int binary = strcmp(requests[i].mode, "xor") == 0;
+            long begin = nowMicros();
+            results[i].kind = replayRequest(&requests[i], port, speed,
+                                          binary ? binaryText : texts[requests[i].alphabet],
+                                          binary ? binaryKey : keys[requests[i].alphabet]);
+            results[i].latency = nowMicros() - begin;
+            results[i].done = 1;
+            exit(0);
+        }
+    }
+    while (wait(NULL) > 0)
+        ;
+
+    // Latency of every request that got a result
+    long* latencies = malloc(count * sizeof(long));
+    int succeeded = 0;
+    int kinds[5] = {0};
+    for (int i = 0; i < count; i++) {
+        if (!results[i].done)
+            results[i].kind = REPLAY_FAILED;
+        kinds[results[i].kind]++;
+        if (results[i].kind == REPLAY_OK)
+            latencies[succeeded++] = results[i].latency;
+    }
+    qsort(latencies, succeeded, sizeof(long), compareLong);
+    printf("requests %d, ok %d, stalled %d, closed %d, rejected %d, failed %d, replay took %ld us\n",
+           count, kinds[REPLAY_OK], kinds[REPLAY_STALLED], kinds[REPLAY_CLOSED], kinds[REPLAY_REJECTED],
+           kinds[REPLAY_FAILED], nowMicros() - replayStart);
+    if (succeeded > 0) {
+        printf("latency us: p50 %ld, p90 %ld, p99 %ld, max %ld\n",
+               latencies[succeeded * 50 / 100], latencies[succeeded * 90 / 100],
+               latencies[succeeded * 99 / 100], latencies[succeeded - 1]);
+    }
+    return 0;
+}
@@ -0,0 +1,161 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/**
+* Tracing spans for the servers and clients
+* 1. TRACE_BEGIN(start) takes a timestamp, TRACE_END("phase", start) records a span.
+* 2. Spans go into a lock-free ring buffer in shared memory, so forked children write
+*    into the same ring as the process that called traceInit.
+* 3. traceFlush writes the spans as Chrome trace JSON, which Perfetto and
+*    chrome://tracing open. The servers flush from the parent, off the request path,
+*    at least once a second and before exiting on SIGTERM or SIGINT.
+*
+* Turned on at runtime with environment variables:
+* OTP_TRACE=file         where the spans are written, tracing is off without it
+* OTP_TRACE_SAMPLE=rate  fraction of requests traced, 0 to 1, defaults to 1
+*
+* Build with -DOTP_NO_TRACE to remove every probe.
+*/
+
+#ifdef OTP_NO_TRACE
+
+#define TRACE_BEGIN(start)
+#define TRACE_END(name, start)
+#define traceInit()
+#define traceSample()
+#define traceFlush()
+
+#else
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// Must be a power of 2 so the index wraps with a mask
+#define TRACE_RING_SIZE 4096
+
+// sequence is index + 1 once the span at that index is fully written
+// and 0 while a writer is filling it in
+struct traceEvent {
+    volatile unsigned long sequence;
+    const char* name;
+    long start;
+    long duration;
+    int pid;
+};
+
+// Writers claim a slot by adding to head, only the flushing process moves tail
+// A full ring overwrites the oldest spans
+struct traceRing {
+    volatile unsigned long head;
+    unsigned long tail;
+    struct traceEvent events[TRACE_RING_SIZE];
+};
+
+static struct traceRing* traceRing = NULL;
+static FILE* traceFile = NULL;
+static double traceSampleRate = 1.0;
+// Only the process that called traceInit flushes, children just record
+static pid_t traceOwner = 0;
+// Whether spans of the current request are recorded, picked by traceSample
+static int traceActive = 0;
+
+// Monotonic time in nanoseconds, clock_gettime goes through the vDSO so it doesn't enter the kernel
+static inline long traceNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000L + now.tv_nsec;
+}
+
+#define TRACE_BEGIN(start) long start = traceActive ? traceNow() : 0
+#define TRACE_END(name, start) do { if (traceActive) traceRecord(name, start); } while (0)
+
+// Adds a span from start until now to the ring
+static inline void traceRecord(const char* name, long start) {
+    long end = traceNow();
+    unsigned long index = __sync_fetch_and_add(&traceRing->head, 1);
+    struct traceEvent* event = &traceRing->events[index & (TRACE_RING_SIZE - 1)];
+    event->sequence = 0;
+    __sync_synchronize();
+    event->name = name;
+    event->start = start;
+    event->duration = end - start;
+    event->pid = getpid();
+    __sync_synchronize();
+    event->sequence = index + 1;
+}
+
+// Decides whether the next request is traced, based on OTP_TRACE_SAMPLE
+// Children inherit the decision made before fork
+static void traceSample(void) {
+    traceActive = traceRing && (traceSampleRate >= 1.0 || drand48() < traceSampleRate);
+}
+
+// Writes every finished span to the trace file
+// A slot that is still being written stops the flush, unless the ring has
+// moved half way round since, which means its writer died part way through
+static void traceFlush(void) {
+    if (!traceRing || getpid() != traceOwner)
+        return;
+    struct traceRing* ring = traceRing;
+    unsigned long head = ring->head;
+    // The ring wrapped past spans that were never flushed
+    if (head - ring->tail > TRACE_RING_SIZE) {
+        ring->tail = head - TRACE_RING_SIZE;
+    }
+    while (ring->tail < head) {
+        struct traceEvent* event = &ring->events[ring->tail & (TRACE_RING_SIZE - 1)];
+        unsigned long sequence = event->sequence;
+        __sync_synchronize();
+        struct traceEvent copy = *event;
+        __sync_synchronize();
+        if (sequence != ring->tail + 1 || event->sequence != sequence) {
+            if (head - ring->tail < TRACE_RING_SIZE / 2)
+                break;
+            ring->tail++;
+            continue;
+        }
+        // Chrome trace complete event, times are in microseconds
+        fprintf(traceFile, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d},\n",
+                copy.name, copy.start / 1000.0, copy.duration / 1000.0, copy.pid, copy.pid);
+        ring->tail++;
+    }
+    fflush(traceFile);
+}
+
+// Sets up tracing if OTP_TRACE is set
+// Call before forking so children share the ring
+static void traceInit(void) {
+    const char* path = getenv("OTP_TRACE");
+    if (!path)
+        return;
+    const char* rate = getenv("OTP_TRACE_SAMPLE");
+    if (rate)
+        traceSampleRate = atof(rate);
+    traceFile = fopen(path, "a");
+    if (!traceFile)
+        return;
+    // The JSON array format allows the closing bracket to be left off, so
+    // spans can be appended as they are flushed
+    if (ftell(traceFile) == 0)
+        fprintf(traceFile, "[\n");
+    // Nothing can be left in the stdio buffer when forking or children would write it again
+    fflush(traceFile);
+    traceRing = mmap(NULL, sizeof(*traceRing), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (traceRing == MAP_FAILED) {
+        traceRing = NULL;
+        return;
+    }
+    traceOwner = getpid();
+    srand48(traceOwner ^ traceNow());
+    // Anything not flushed by the caller is written when the process exits
+    atexit(traceFlush);
+    traceSample();
+}
+
+#endif
+
+#endif